@@ -1,22 +1,51 @@
 #include "Wu.h"
 #include <assert.h>
-#include <openssl/ec.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include "WuAlloc.h"
 #include "WuArena.h"
 #include "WuClock.h"
+#include "WuCommandQueue.h"
 #include "WuCrypto.h"
 #include "WuMath.h"
+#include "WuMetrics.h"
 #include "WuPool.h"
 #include "WuQueue.h"
+#include "WuRecorder.h"
 #include "WuRng.h"
 #include "WuSctp.h"
 #include "WuSdp.h"
 #include "WuStun.h"
+#include "WuTimeSync.h"
+#include "WuTopic.h"
+#include "WuTrace.h"
 
 const double kMaxClientTtl = 8.0;
 const double heartbeatInterval = 4.0;
+// Deferred heartbeats still go out this long before the client would expire.
+const double kHeartbeatDeferMargin = 1.0;
+const double kOverloadSmoothing = 0.125;
+const double kOverloadHysteresis = 0.9;
+const double kShedInterval = 0.5;
+const double kTimeSyncGain = 0.125;
+const double kTimeSyncMaxRttRatio = 1.5;
+// Handshake flights are fragmented to the path MTU, anything larger is
+// dropped instead of queued.
+const int32_t kMaxHandshakeDatagramLength = 2048;
+const int32_t kInitialHandshakeQueueSize = 16;
 const int kDefaultMTU = 1400;
+const int32_t kDefaultMaxClients = 256;
+const int32_t kDefaultClientChunkSize = 64;
+const int32_t kServerUserLength = 4;
+const int32_t kServerPasswordLength = 24;
+const int32_t kMaxRemoteUserLength = 32;
+const double kMaxDtlsRetransmitTimeout = 4.0;
+const int32_t kMaxInFlightChunks = 128;
+const int32_t kMaxSctpPacketLength = 4096;
+// Room left for user data after the SCTP common and DATA chunk headers.
+const int32_t kMaxMessageLength = kMaxSctpPacketLength - 12 - 16;
 
 static void DefaultErrorCallback(const char*, void*) {}
 static void WriteNothing(const uint8_t*, size_t, const WuClient*, void*) {}
@@ -43,14 +72,6 @@ struct DataChannelPacket {
   } as;
 };
 
-enum WuClientState {
-  WuClient_Dead,
-  WuClient_WaitingRemoval,
-  WuClient_DTLSHandshake,
-  WuClient_SCTPEstablished,
-  WuClient_DataChannelOpen
-};
-
 static int32_t ParseDataChannelControlPacket(const uint8_t* buf, size_t len,
                                              DataChannelPacket* packet) {
   ReadScalarSwapped(buf, &packet->messageType);
@@ -62,19 +83,55 @@ void WuReportError(Wu* wu, const char* description) {
 }
 
 struct WuClient {
-  StunUserIdentifier serverUser;
-  StunUserIdentifier serverPassword;
-  StunUserIdentifier remoteUser;
-  StunUserIdentifier remoteUserPassword;
+  uint8_t serverUser[kServerUserLength];
+  uint8_t serverPassword[kServerPasswordLength];
+  uint8_t remoteUser[kMaxRemoteUserLength];
+  uint8_t remoteUserLength;
   WuAddress address;
   WuClientState state = WuClient_Dead;
   uint16_t localSctpPort = 0;
   uint16_t remoteSctpPort = 0;
   uint32_t sctpVerificationTag = 0;
-  uint32_t remoteTsn = 0;
   uint32_t tsn = 1;
-  double ttl = kMaxClientTtl;
-  double nextHeartbeat = heartbeatInterval;
+  SctpTsnTracker receivedTsns;
+
+  // Flow control towards the peer. DATA chunk sizes from ackedTsn + 1 up to
+  // tsn - 1 are kept in inFlight, indexed by TSN.
+  uint32_t peerRwnd = 0;
+  uint32_t ackedTsn = 0;
+  int32_t bufferedAmount = 0;
+  bool sendBlocked = false;
+  double ackedAt = 0.0;
+  uint16_t inFlight[kMaxInFlightChunks];
+  double expiresAt = 0.0;
+  double heartbeatAt = 0.0;
+  double lastDataAt = 0.0;
+  double createdAt = 0.0;
+
+  // Position in Wu::clients. Active clients occupy [0, numActiveClients), the
+  // hibernated ones the rest and are also kept in a heap ordered by their
+  // next timer deadline.
+  int32_t index = 0;
+  int32_t heapIndex = -1;
+
+  // Unlike the WuClient address, never reused by a later client.
+  uint32_t id = 0;
+
+  uint64_t cycles[WuCost_Count];
+
+  // Total cycles when the current shed interval began, and the cycles spent
+  // during the previous one, see WuShedClient.
+  uint64_t shedMark;
+  uint64_t shedCycles;
+
+  // Topics the client is a member of, so that leaving only searches them
+  // when there is something to find.
+  int32_t numTopics = 0;
+
+  // Transmit time of the last time sync packet sent, the next sample has to
+  // echo it.
+  double timeSyncSentAt = 0.0;
+  WuTimeSync timeSync;
 
   SSL* ssl;
   BIO* inBio;
@@ -83,8 +140,24 @@ struct WuClient {
   void* user;
 };
 
+// A DTLS datagram for a client that hasn't finished its handshake, waiting
+// for the per-tick handshake budget.
+struct WuHandshakeDatagram {
+  WuClient* client;
+  uint32_t clientId;
+  int32_t length;
+  uint8_t data[kMaxHandshakeDatagramLength];
+};
+
 void WuClientSetUserData(WuClient* client, void* user) { client->user = user; }
 
+static void WuClientRecord(Wu* wu, const WuClient* client, WuRecordType type,
+                           uint8_t subtype = 0, uint32_t value = 0,
+                           uint16_t length = 0) {
+  WuRecorderPush(wu->recorder, wu->time, client->id, type, subtype, value,
+                 length);
+}
+
 void* WuClientGetUserData(const WuClient* client) { return client->user; }
 
 static void WuClientFinish(WuClient* client) {
@@ -95,50 +168,379 @@ static void WuClientFinish(WuClient* client) {
   client->state = WuClient_Dead;
 }
 
-static void WuClientStart(const Wu* wu, WuClient* client) {
-  client->state = WuClient_DTLSHandshake;
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+// Starts at WuConf::dtlsRetransmitTimeout instead of OpenSSL's 1 second and
+// doubles on every retransmission.
+static unsigned int WuDtlsTimer(SSL* ssl, unsigned int previousUs) {
+  const Wu* wu = (const Wu*)SSL_get_app_data(ssl);
+  if (previousUs == 0) {
+    return (unsigned int)(wu->dtlsRetransmitTimeout * 1e6);
+  }
+
+  return (unsigned int)Min(previousUs * 2.0, kMaxDtlsRetransmitTimeout * 1e6);
+}
+#endif
+
+// Clients created by an SDP exchange only get an SSL object once their first
+// authenticated STUN binding arrives, until then they expire after
+// WuConf::bindingTimeout.
+static void WuClientStart(Wu* wu, WuClient* client) {
+  client->state = WuClient_WaitingBinding;
+  client->id = ++wu->nextClientId;
   client->remoteSctpPort = 0;
   client->sctpVerificationTag = 0;
-  client->remoteTsn = 0;
   client->tsn = 1;
-  client->ttl = kMaxClientTtl;
-  client->nextHeartbeat = heartbeatInterval;
+  SctpTsnTrackerInit(&client->receivedTsns, 1);
+  client->peerRwnd = kSctpDefaultBufferSpace;
+  client->ackedTsn = client->tsn - 1;
+  client->bufferedAmount = 0;
+  client->sendBlocked = false;
+  client->ackedAt = wu->time;
+  client->expiresAt = wu->time + wu->bindingTimeout;
+  client->heartbeatAt = wu->time + heartbeatInterval;
+  client->lastDataAt = wu->time;
+  client->createdAt = MsNow() * 0.001;
+  client->heapIndex = -1;
+  client->timeSyncSentAt = 0.0;
+  memset(&client->timeSync, 0, sizeof(client->timeSync));
   client->user = NULL;
+  client->ssl = NULL;
+  client->inBio = NULL;
+  client->outBio = NULL;
+}
 
+static int32_t WuClientStartDtls(Wu* wu, WuClient* client) {
+  // Options and ECDH parameters are inherited from sslCtx
   client->ssl = SSL_new(wu->sslCtx);
+  if (!client->ssl) {
+    return 0;
+  }
+
+  SSL_set_app_data(client->ssl, wu);
 
   client->inBio = BIO_new(BIO_s_mem());
   BIO_set_mem_eof_return(client->inBio, -1);
   client->outBio = BIO_new(BIO_s_mem());
   BIO_set_mem_eof_return(client->outBio, -1);
   SSL_set_bio(client->ssl, client->inBio, client->outBio);
-  SSL_set_options(client->ssl, SSL_OP_SINGLE_ECDH_USE);
-  SSL_set_options(client->ssl, SSL_OP_NO_SESSION_RESUMPTION_ON_RENEGOTIATION);
-  SSL_set_tmp_ecdh(client->ssl, EC_KEY_new_by_curve_name(NID_X9_62_prime256v1));
   SSL_set_accept_state(client->ssl);
   SSL_set_mtu(client->ssl, kDefaultMTU);
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+  if (wu->dtlsRetransmitTimeout > 0.0) {
+    DTLS_set_timer_cb(client->ssl, WuDtlsTimer);
+  }
+#endif
+
+  client->state = WuClient_DTLSHandshake;
+  client->expiresAt = wu->time + kMaxClientTtl;
+  return 1;
 }
 
-static void WuSendSctp(const Wu* wu, WuClient* client, const SctpPacket* packet,
+static void WuSendSctp(Wu* wu, WuClient* client, const SctpPacket* packet,
                        const SctpChunk* chunks, int32_t numChunks);
 
+// Both arrays are replaced or neither, they index the same clients.
+static int32_t WuReserveClients(Wu* wu, int32_t capacity) {
+  WuClient** clients =
+      (WuClient**)WuAlloc(&wu->allocator, capacity * sizeof(WuClient*));
+  WuClient** hibernated =
+      (WuClient**)WuAlloc(&wu->allocator, capacity * sizeof(WuClient*));
+  if (!clients || !hibernated) {
+    WuFree(&wu->allocator, clients);
+    WuFree(&wu->allocator, hibernated);
+    return 0;
+  }
+
+  const int32_t kept = Min(capacity, wu->clientsCapacity);
+  if (kept > 0) {
+    memcpy(clients, wu->clients, kept * sizeof(WuClient*));
+    memcpy(hibernated, wu->hibernatedClients, kept * sizeof(WuClient*));
+  }
+
+  WuFree(&wu->allocator, wu->clients);
+  WuFree(&wu->allocator, wu->hibernatedClients);
+  wu->clients = clients;
+  wu->hibernatedClients = hibernated;
+  wu->clientsCapacity = capacity;
+  return 1;
+}
+
+static void WuSwapClients(Wu* wu, int32_t a, int32_t b) {
+  WuClient* first = wu->clients[a];
+  WuClient* second = wu->clients[b];
+  wu->clients[a] = second;
+  second->index = a;
+  wu->clients[b] = first;
+  first->index = b;
+}
+
+static double WuClientDeadline(const WuClient* client) {
+  return Min(client->heartbeatAt, client->expiresAt);
+}
+
+static void WuHeapSet(Wu* wu, int32_t i, WuClient* client) {
+  wu->hibernatedClients[i] = client;
+  client->heapIndex = i;
+}
+
+static void WuHeapSiftUp(Wu* wu, int32_t i) {
+  WuClient* client = wu->hibernatedClients[i];
+  const double deadline = WuClientDeadline(client);
+
+  while (i > 0) {
+    int32_t parent = (i - 1) / 2;
+    WuClient* p = wu->hibernatedClients[parent];
+    if (WuClientDeadline(p) <= deadline) {
+      break;
+    }
+
+    WuHeapSet(wu, i, p);
+    i = parent;
+  }
+
+  WuHeapSet(wu, i, client);
+}
+
+static void WuHeapSiftDown(Wu* wu, int32_t i) {
+  WuClient* client = wu->hibernatedClients[i];
+  const double deadline = WuClientDeadline(client);
+  const int32_t n = wu->numHibernatedClients;
+
+  for (;;) {
+    int32_t child = 2 * i + 1;
+    if (child >= n) {
+      break;
+    }
+
+    if (child + 1 < n &&
+        WuClientDeadline(wu->hibernatedClients[child + 1]) <
+            WuClientDeadline(wu->hibernatedClients[child])) {
+      child++;
+    }
+
+    WuClient* c = wu->hibernatedClients[child];
+    if (deadline <= WuClientDeadline(c)) {
+      break;
+    }
+
+    WuHeapSet(wu, i, c);
+    i = child;
+  }
+
+  WuHeapSet(wu, i, client);
+}
+
+static void WuHeapRemove(Wu* wu, WuClient* client) {
+  const int32_t i = client->heapIndex;
+  const int32_t last = --wu->numHibernatedClients;
+  client->heapIndex = -1;
+
+  if (i != last) {
+    WuClient* moved = wu->hibernatedClients[last];
+    WuHeapSet(wu, i, moved);
+    WuHeapSiftUp(wu, i);
+    WuHeapSiftDown(wu, moved->heapIndex);
+  }
+}
+
+// DTLS writes don't set up a freed write buffer again, SSL_alloc_buffers must
+// run before any write.
+static void WuClientFreeSslBuffers(WuClient* client) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  SSL_free_buffers(client->ssl);
+#endif
+}
+
+static void WuClientAllocSslBuffers(WuClient* client) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  SSL_alloc_buffers(client->ssl);
+#endif
+}
+
+// Mem BIOs keep their buffers after being drained. Hibernated clients swap
+// them for fresh ones and drop their SSL record buffers, which are
+// reallocated once on wake-up. Active clients keep them so that the send and
+// receive paths don't allocate.
+static void WuClientCompact(WuClient* client) {
+  if (BIO_ctrl_pending(client->inBio) > 0 ||
+      BIO_ctrl_pending(client->outBio) > 0) {
+    return;
+  }
+
+  SSL_set_mode(client->ssl, SSL_MODE_RELEASE_BUFFERS);
+  WuClientFreeSslBuffers(client);
+
+  BIO* inBio = BIO_new(BIO_s_mem());
+  BIO* outBio = BIO_new(BIO_s_mem());
+
+  if (!inBio || !outBio) {
+    BIO_free(inBio);
+    BIO_free(outBio);
+    return;
+  }
+
+  BIO_set_mem_eof_return(inBio, -1);
+  BIO_set_mem_eof_return(outBio, -1);
+  SSL_set_bio(client->ssl, inBio, outBio);
+  client->inBio = inBio;
+  client->outBio = outBio;
+}
+
+static void WuHibernateClient(Wu* wu, WuClient* client) {
+  WuSwapClients(wu, client->index, wu->numActiveClients - 1);
+  wu->numActiveClients--;
+
+  WuHeapSet(wu, wu->numHibernatedClients++, client);
+  WuHeapSiftUp(wu, client->heapIndex);
+
+  WuClientCompact(client);
+  WuClientRecord(wu, client, WuRecord_Hibernate);
+}
+
+static void WuWakeClient(Wu* wu, WuClient* client) {
+  if (client->heapIndex < 0) {
+    return;
+  }
+
+  WuHeapRemove(wu, client);
+  WuSwapClients(wu, client->index, wu->numActiveClients);
+  wu->numActiveClients++;
+  SSL_clear_mode(client->ssl, SSL_MODE_RELEASE_BUFFERS);
+  WuClientAllocSslBuffers(client);
+  WuClientRecord(wu, client, WuRecord_Wake);
+}
+
+static void WuClientRefreshTtl(Wu* wu, WuClient* client) {
+  client->expiresAt = wu->time + kMaxClientTtl;
+
+  if (client->heapIndex >= 0) {
+    WuHeapSiftDown(wu, client->heapIndex);
+  }
+}
+
+static void WuPushEvent(Wu* wu, WuEvent evt) {
+  if (evt.type == WuEvent_ClientJoin) {
+    WU_TRACE3(client_join, evt.client, evt.client->address.host,
+              evt.client->address.port);
+  }
+
+  WU_TRACE3(event_pushed, evt.client, int32_t(evt.type),
+            evt.type == WuEvent_BinaryData || evt.type == WuEvent_TextData
+                ? evt.length
+                : 0);
+  if (!WuQueuePush(wu->pendingEvents, &evt)) {
+    wu->stats.droppedEvents++;
+  }
+}
+
+static void WuClientCheckWritable(Wu* wu, WuClient* client) {
+  if (client->sendBlocked &&
+      client->bufferedAmount <= wu->sendHighWatermark / 2) {
+    client->sendBlocked = false;
+    WuEvent evt;
+    evt.type = WuEvent_ClientWritable;
+    evt.client = client;
+    WuPushEvent(wu, evt);
+  }
+}
+
+static int32_t WuClientNumInFlight(const WuClient* client) {
+  return int32_t(client->tsn - 1 - client->ackedTsn);
+}
+
+static int32_t WuClientCanSend(const WuClient* client, int32_t length) {
+  return WuClientNumInFlight(client) < kMaxInFlightChunks &&
+         uint32_t(client->bufferedAmount + length) <= client->peerRwnd;
+}
+
+// Unreliable DATA is never retransmitted. Once we've told the peer to skip
+// it, or it has gone unacknowledged for a heartbeat interval, it no longer
+// counts against the window.
+static void WuClientAbandonInFlight(Wu* wu, WuClient* client) {
+  client->ackedTsn = client->tsn - 1;
+  client->bufferedAmount = 0;
+  client->ackedAt = wu->time;
+  WuClientCheckWritable(wu, client);
+}
+
+static void WuClientTrackSent(Wu* wu, WuClient* client, uint32_t tsn,
+                              int32_t length) {
+  if (WuClientNumInFlight(client) > kMaxInFlightChunks) {
+    WuClientAbandonInFlight(wu, client);
+    client->ackedTsn = tsn - 1;
+  }
+
+  client->inFlight[tsn % kMaxInFlightChunks] = uint16_t(length);
+  client->bufferedAmount += length;
+}
+
+static void WuClientHandleAck(Wu* wu, WuClient* client, uint32_t cumulativeTsn,
+                              uint32_t rwnd) {
+  client->peerRwnd = rwnd;
+
+  const int32_t acked = int32_t(cumulativeTsn - client->ackedTsn);
+  if (acked > 0 && acked <= WuClientNumInFlight(client)) {
+    for (int32_t i = 1; i <= acked; i++) {
+      const uint32_t tsn = client->ackedTsn + uint32_t(i);
+      client->bufferedAmount -= client->inFlight[tsn % kMaxInFlightChunks];
+    }
+
+    client->ackedTsn = cumulativeTsn;
+    client->ackedAt = wu->time;
+  }
+
+  WuClientCheckWritable(wu, client);
+}
+
+// Clients that are still waiting for their STUN binding and haven't expired
+// yet have no pending events, so they can be dropped to make room for a new
+// one. The application never got a join for them, but may still hold the
+// SDPResult::client of their offer, see Wu.h.
+static WuClient* WuFindOldestUnboundClient(Wu* wu) {
+  WuClient* oldest = NULL;
+
+  for (int32_t i = 0; i < wu->numActiveClients; i++) {
+    WuClient* client = wu->clients[i];
+    if (client->state == WuClient_WaitingBinding &&
+        client->expiresAt > wu->time &&
+        (!oldest || client->createdAt < oldest->createdAt)) {
+      oldest = client;
+    }
+  }
+
+  return oldest;
+}
+
 static WuClient* WuNewClient(Wu* wu) {
   WuClient* client = (WuClient*)WuPoolAcquire(wu->clientPool);
 
+  if (!client) {
+    WuClient* unbound = WuFindOldestUnboundClient(wu);
+    if (unbound) {
+      WuClientRecord(wu, unbound, WuRecord_Expired);
+      WuRemoveClient(wu, unbound);
+      client = (WuClient*)WuPoolAcquire(wu->clientPool);
+    }
+  }
+
   if (client) {
+    if (wu->numClients == wu->clientsCapacity &&
+        !WuReserveClients(wu, WuPoolCapacity(wu->clientPool))) {
+      WuPoolRelease(wu->clientPool, client);
+      return NULL;
+    }
+
     memset(client, 0, sizeof(WuClient));
     WuClientStart(wu, client);
+    client->index = wu->numClients;
     wu->clients[wu->numClients++] = client;
+    WuSwapClients(wu, client->index, wu->numActiveClients++);
     return client;
   }
 
   return NULL;
 }
 
-static void WuPushEvent(Wu* wu, WuEvent evt) {
-  WuQueuePush(wu->pendingEvents, &evt);
-}
-
 static void WuSendSctpShutdown(Wu* wu, WuClient* client) {
   SctpPacket response;
   response.sourcePort = client->localSctpPort;
@@ -149,22 +551,41 @@ static void WuSendSctpShutdown(Wu* wu, WuClient* client) {
   rc.type = Sctp_Shutdown;
   rc.flags = 0;
   rc.length = SctpChunkLength(sizeof(rc.as.shutdown.cumulativeTsnAck));
-  rc.as.shutdown.cumulativeTsnAck = client->remoteTsn;
+  rc.as.shutdown.cumulativeTsnAck = client->receivedTsns.cumulativeTsn;
 
   WuSendSctp(wu, client, &response, &rc, 1);
 }
 
 void WuRemoveClient(Wu* wu, WuClient* client) {
-  for (int32_t i = 0; i < wu->numClients; i++) {
-    if (wu->clients[i] == client) {
-      WuSendSctpShutdown(wu, client);
-      WuClientFinish(client);
-      WuPoolRelease(wu->clientPool, client);
-      wu->clients[i] = wu->clients[wu->numClients - 1];
-      wu->numClients--;
-      return;
-    }
+  if (client->index >= wu->numClients || wu->clients[client->index] != client) {
+    return;
+  }
+
+  WU_TRACE1(client_leave, client);
+  WuSendSctpShutdown(wu, client);
+  WuClientRecord(wu, client, WuRecord_Leave);
+
+  if (wu->leaveRecordsFn) {
+    WuRecorderForEach(wu->recorder, client->id, wu->leaveRecordsFn,
+                      wu->leaveRecordsUserData);
+  }
+
+  if (client->heapIndex >= 0) {
+    WuHeapRemove(wu, client);
+  } else {
+    WuSwapClients(wu, client->index, wu->numActiveClients - 1);
+    wu->numActiveClients--;
+  }
+
+  WuSwapClients(wu, client->index, wu->numClients - 1);
+  wu->numClients--;
+
+  for (int32_t i = 0; i < wu->numTopics && client->numTopics > 0; i++) {
+    client->numTopics -= WuTopicRemove(wu->topics[i], client);
   }
+
+  WuClientFinish(client);
+  WuPoolRelease(wu->clientPool, client);
 }
 
 static WuClient* WuFindClient(Wu* wu, const WuAddress* address) {
@@ -183,8 +604,10 @@ static WuClient* WuFindClientByCreds(Wu* wu, const StunUserIdentifier* svUser,
                                      const StunUserIdentifier* clUser) {
   for (int32_t i = 0; i < wu->numClients; i++) {
     WuClient* client = wu->clients[i];
-    if (StunUserIdentifierEqual(&client->serverUser, svUser) &&
-        StunUserIdentifierEqual(&client->remoteUser, clUser)) {
+    if (MemEqual(client->serverUser, kServerUserLength, svUser->identifier,
+                 svUser->length) &&
+        MemEqual(client->remoteUser, client->remoteUserLength,
+                 clUser->identifier, clUser->length)) {
       return client;
     }
   }
@@ -192,37 +615,115 @@ static WuClient* WuFindClientByCreds(Wu* wu, const StunUserIdentifier* svUser,
   return NULL;
 }
 
-static void WuClientSendPendingDTLS(const Wu* wu, WuClient* client) {
+static void WuWriteUdp(Wu* wu, const WuClient* client, const uint8_t* data,
+                       int32_t length) {
+  WU_TRACE2(datagram_sent, client, length);
+  wu->stats.datagramsOut++;
+  wu->stats.bytesOut += length;
+  wu->writeUdpData(data, length, client, wu->userData);
+}
+
+// Retransmits the last handshake flight when it's likely to have been lost.
+static void WuClientHandleDtlsTimeout(Wu* wu, WuClient* client) {
+  if (SSL_is_init_finished(client->ssl)) {
+    return;
+  }
+
+  if (DTLSv1_handle_timeout(client->ssl) > 0) {
+    wu->stats.dtlsRetransmits++;
+    WuClientRecord(wu, client, WuRecord_DtlsRetransmit);
+  }
+}
+
+static void WuClientSendPendingDTLS(Wu* wu, WuClient* client) {
   uint8_t sendBuffer[4096];
 
   while (BIO_ctrl_pending(client->outBio) > 0) {
     int bytes = BIO_read(client->outBio, sendBuffer, sizeof(sendBuffer));
     if (bytes > 0) {
-      wu->writeUdpData(sendBuffer, bytes, client, wu->userData);
+      WuWriteUdp(wu, client, sendBuffer, bytes);
     }
   }
 }
 
-static void TLSSend(const Wu* wu, WuClient* client, const void* data,
+static void TLSSend(Wu* wu, WuClient* client, const void* data,
                     int32_t length) {
   if (client->state < WuClient_DTLSHandshake ||
       !SSL_is_init_finished(client->ssl)) {
     return;
   }
 
+  // Hibernated clients only get control chunks, they hold record buffers
+  // for the duration of the write.
+  const bool hibernated = client->heapIndex >= 0;
+  if (hibernated) {
+    WuClientAllocSslBuffers(client);
+  }
+
   SSL_write(client->ssl, data, length);
   WuClientSendPendingDTLS(wu, client);
+
+  if (hibernated) {
+    WuClientFreeSslBuffers(client);
+  }
 }
 
-static void WuSendSctp(const Wu* wu, WuClient* client, const SctpPacket* packet,
+static void WuSendSctp(Wu* wu, WuClient* client, const SctpPacket* packet,
                        const SctpChunk* chunks, int32_t numChunks) {
-  uint8_t outBuffer[4096];
-  memset(outBuffer, 0, sizeof(outBuffer));
+  bool hasData = false;
+  for (int32_t i = 0; i < numChunks; i++) {
+    WuClientRecord(wu, client, WuRecord_SctpChunkOut, chunks[i].type,
+                   chunks[i].type == Sctp_Data ? chunks[i].as.data.tsn : 0,
+                   chunks[i].length);
+    hasData = hasData || chunks[i].type == Sctp_Data;
+  }
+
+  // SerializeSctpPacket writes every byte it covers, padding included.
+  uint8_t outBuffer[kMaxSctpPacketLength];
   size_t bytesWritten = SerializeSctpPacket(packet, chunks, numChunks,
                                             outBuffer, sizeof(outBuffer));
+  if (bytesWritten == 0) {
+    return;
+  }
+
+  if (!hasData) {
+    wu->stats.controlPacketsOut++;
+  }
+
   TLSSend(wu, client, outBuffer, bytesWritten);
 }
 
+// A sample needs the client to echo our last transmit time. Samples with a
+// round trip well above the smoothed one waited in a queue somewhere, their
+// offset is skewed by the asymmetry and only the RTT is updated.
+static void WuClientTimeSyncSample(WuClient* client,
+                                   const TimeSyncPacket* packet, double now) {
+  if (client->timeSyncSentAt == 0.0 ||
+      packet->origin != client->timeSyncSentAt) {
+    return;
+  }
+
+  const double rtt =
+      (now - packet->origin) - (packet->transmit - packet->receive);
+  const double offset =
+      ((packet->receive - packet->origin) + (packet->transmit - now)) * 0.5;
+  if (rtt < 0.0) {
+    return;
+  }
+
+  WuTimeSync* sync = &client->timeSync;
+  if (sync->samples == 0) {
+    sync->offset = offset;
+    sync->rtt = rtt;
+  } else {
+    if (rtt <= sync->rtt * kTimeSyncMaxRttRatio) {
+      sync->offset += kTimeSyncGain * (offset - sync->offset);
+    }
+    sync->rtt += kTimeSyncGain * (rtt - sync->rtt);
+  }
+  sync->samples++;
+}
+
 static void WuHandleSctp(Wu* wu, WuClient* client, const uint8_t* buf,
                          int32_t len) {
   const size_t maxChunks = 8;
@@ -234,88 +735,149 @@ static void WuHandleSctp(Wu* wu, WuClient* client, const uint8_t* buf,
     return;
   }
 
+  // Responses to the chunks of a packet go out bundled in a single packet,
+  // control chunks first (a COOKIE-ACK has to lead), then one SACK, then
+  // DATA. A DCEP OPEN that arrives with the COOKIE-ECHO is answered with
+  // COOKIE-ACK, SACK and DCEP ACK in one round trip.
+  SctpChunk control[maxChunks + 2];
+  SctpChunk data[maxChunks];
+  int32_t numControl = 0;
+  int32_t numData = 0;
+  bool needSack = false;
+  bool needForwardTsn = false;
+  uint32_t dupTsns[maxChunks];
+  uint16_t numDupTsns = 0;
+  const uint8_t dcepAck = DCMessage_Ack;
+  uint8_t timeSyncReplies[maxChunks][kTimeSyncPacketLength];
+
+  SctpPacket response;
+  response.sourcePort = sctpPacket.destionationPort;
+  response.destionationPort = sctpPacket.sourcePort;
+  response.verificationTag = client->sctpVerificationTag;
+
   for (size_t n = 0; n < nChunk; n++) {
     SctpChunk* chunk = &chunks[n];
+    WU_TRACE3(sctp_chunk, client, chunk->type,
+              chunk->type == Sctp_Data ? chunk->as.data.tsn : 0);
+    WuClientRecord(wu, client, WuRecord_SctpChunkIn, chunk->type,
+                   chunk->type == Sctp_Data ? chunk->as.data.tsn : 0,
+                   chunk->length);
+
+    // Keep-alive traffic and acks for our own sends are handled without
+    // waking a hibernated client, anything else wakes it up.
+    if (chunk->type != Sctp_Heartbeat && chunk->type != Sctp_HeartbeatAck &&
+        chunk->type != Sctp_Sack) {
+      WuWakeClient(wu, client);
+    }
+
     if (chunk->type == Sctp_Data) {
       auto* dataChunk = &chunk->as.data;
       const uint8_t* userDataBegin = dataChunk->userData;
       const int32_t userDataLength = dataChunk->userDataLength;
 
-      client->remoteTsn = Max(chunk->as.data.tsn, client->remoteTsn);
-      client->ttl = kMaxClientTtl;
+      client->lastDataAt = wu->time;
+      WuClientRefreshTtl(wu, client);
+      needSack = true;
+      wu->stats.dataChunksIn++;
+
+      // Retransmitted or duplicated by the network and already delivered. A
+      // repeated DCEP OPEN is still answered in case our ACK got lost.
+      if (!SctpTsnTrackerAdd(&client->receivedTsns, dataChunk->tsn)) {
+        dupTsns[numDupTsns++] = dataChunk->tsn;
+        wu->stats.duplicateTsns++;
+        if (dataChunk->protoId != DCProto_Control) {
+          continue;
+        }
+      }
 
+      TimeSyncPacket timeSync;
       if (dataChunk->protoId == DCProto_Control) {
         DataChannelPacket packet;
         ParseDataChannelControlPacket(userDataBegin, userDataLength, &packet);
         if (packet.messageType == DCMessage_Open) {
           client->remoteSctpPort = sctpPacket.sourcePort;
-          uint8_t outType = DCMessage_Ack;
-          SctpPacket response;
-          response.sourcePort = sctpPacket.destionationPort;
-          response.destionationPort = sctpPacket.sourcePort;
-          response.verificationTag = client->sctpVerificationTag;
-
-          SctpChunk rc;
-          rc.type = Sctp_Data;
-          rc.flags = kSctpFlagCompleteUnreliable;
-          rc.length = SctpDataChunkLength(1);
-
-          auto* dc = &rc.as.data;
+
+          SctpChunk* rc = &data[numData++];
+          rc->type = Sctp_Data;
+          rc->flags = kSctpFlagCompleteUnreliable;
+          rc->length = SctpDataChunkLength(1);
+
+          auto* dc = &rc->as.data;
           dc->tsn = client->tsn++;
           dc->streamId = chunk->as.data.streamId;
           dc->streamSeq = 0;
           dc->protoId = DCProto_Control;
-          dc->userData = &outType;
+          dc->userData = &dcepAck;
           dc->userDataLength = 1;
+          WuClientTrackSent(wu, client, dc->tsn, dc->userDataLength);
 
           if (client->state != WuClient_DataChannelOpen) {
             client->state = WuClient_DataChannelOpen;
+            WuHistogramObserve(&wu->stats.joinLatency,
+                               MsNow() * 0.001 - client->createdAt);
+            WuClientRecord(wu, client, WuRecord_DataChannelOpen);
             WuEvent event;
             event.type = WuEvent_ClientJoin;
             event.client = client;
             WuPushEvent(wu, event);
           }
-
-          WuSendSctp(wu, client, &response, &rc, 1);
         }
-      } else if (dataChunk->protoId == DCProto_String) {
-        WuEvent evt;
-        evt.type = WuEvent_TextData;
-        evt.client = client;
-        evt.data = dataChunk->userData;
-        evt.length = dataChunk->userDataLength;
-        WuPushEvent(wu, evt);
-      } else if (dataChunk->protoId == DCProto_Binary) {
+      } else if (wu->timeSync && dataChunk->protoId == DCProto_Binary &&
+                 ParseTimeSyncPacket(userDataBegin, userDataLength,
+                                     &timeSync)) {
+        wu->stats.timeSyncPackets++;
+        const double receivedAt = MsNow() * 0.001;
+        WuClientTimeSyncSample(client, &timeSync, receivedAt);
+
+        TimeSyncPacket reply;
+        reply.origin = timeSync.transmit;
+        reply.receive = receivedAt;
+        reply.transmit = MsNow() * 0.001;
+        client->timeSyncSentAt = reply.transmit;
+
+        uint8_t* replyData = timeSyncReplies[numData];
+        SerializeTimeSyncPacket(&reply, replyData, kTimeSyncPacketLength);
+
+        SctpChunk* rc = &data[numData++];
+        rc->type = Sctp_Data;
+        rc->flags = kSctpFlagCompleteUnreliable;
+        rc->length = SctpDataChunkLength(kTimeSyncPacketLength);
+
+        auto* dc = &rc->as.data;
+        dc->tsn = client->tsn++;
+        dc->streamId = dataChunk->streamId;
+        dc->streamSeq = 0;
+        dc->protoId = DCProto_Binary;
+        dc->userData = replyData;
+        dc->userDataLength = kTimeSyncPacketLength;
+        WuClientTrackSent(wu, client, dc->tsn, dc->userDataLength);
+      } else if (dataChunk->protoId == DCProto_String ||
+                 dataChunk->protoId == DCProto_Binary) {
+        // Events outlive the receive buffer, their data lives until the
+        // arena is reset at the next tick.
+        uint8_t* eventData =
+            (uint8_t*)WuArenaAcquire(wu->arena, userDataLength);
+        if (!eventData) {
+          continue;
+        }
+
+        memcpy(eventData, userDataBegin, userDataLength);
+
         WuEvent evt;
-        evt.type = WuEvent_BinaryData;
+        evt.type = dataChunk->protoId == DCProto_String ? WuEvent_TextData
+                                                        : WuEvent_BinaryData;
         evt.client = client;
-        evt.data = dataChunk->userData;
-        evt.length = dataChunk->userDataLength;
+        evt.data = eventData;
+        evt.length = userDataLength;
         WuPushEvent(wu, evt);
       }
-
-      SctpPacket sack;
-      sack.sourcePort = sctpPacket.destionationPort;
-      sack.destionationPort = sctpPacket.sourcePort;
-      sack.verificationTag = client->sctpVerificationTag;
-
-      SctpChunk rc;
-      rc.type = Sctp_Sack;
-      rc.flags = 0;
-      rc.length = SctpChunkLength(12);
-      rc.as.sack.cumulativeTsnAck = client->remoteTsn;
-      rc.as.sack.advRecvWindow = kSctpDefaultBufferSpace;
-      rc.as.sack.numGapAckBlocks = 0;
-      rc.as.sack.numDupTsn = 0;
-
-      WuSendSctp(wu, client, &sack, &rc, 1);
     } else if (chunk->type == Sctp_Init) {
-      SctpPacket response;
-      response.sourcePort = sctpPacket.destionationPort;
-      response.destionationPort = sctpPacket.sourcePort;
-      response.verificationTag = chunk->as.init.initiateTag;
-      client->sctpVerificationTag = response.verificationTag;
-      client->remoteTsn = chunk->as.init.initialTsn - 1;
+      // INIT and INIT-ACK can't be bundled with other chunks.
+      SctpPacket initResponse = response;
+      initResponse.verificationTag = chunk->as.init.initiateTag;
+      client->sctpVerificationTag = initResponse.verificationTag;
+      SctpTsnTrackerInit(&client->receivedTsns, chunk->as.init.initialTsn);
+      client->peerRwnd = chunk->as.init.windowCredit;
 
       SctpChunk rc;
       rc.type = Sctp_InitAck;
@@ -328,80 +890,140 @@ static void WuHandleSctp(Wu* wu, WuClient* client, const uint8_t* buf,
       rc.as.init.numInboundStreams = chunk->as.init.numOutboundStreams;
       rc.as.init.initialTsn = client->tsn;
 
-      WuSendSctp(wu, client, &response, &rc, 1);
-      break;
+      WuSendSctp(wu, client, &initResponse, &rc, 1);
+      return;
     } else if (chunk->type == Sctp_CookieEcho) {
       if (client->state < WuClient_SCTPEstablished) {
         client->state = WuClient_SCTPEstablished;
       }
-      SctpPacket response;
-      response.sourcePort = sctpPacket.destionationPort;
-      response.destionationPort = sctpPacket.sourcePort;
-      response.verificationTag = client->sctpVerificationTag;
-
-      SctpChunk rc;
-      rc.type = Sctp_CookieAck;
-      rc.flags = 0;
-      rc.length = SctpChunkLength(0);
 
-      WuSendSctp(wu, client, &response, &rc, 1);
+      SctpChunk* rc = &control[numControl++];
+      rc->type = Sctp_CookieAck;
+      rc->flags = 0;
+      rc->length = SctpChunkLength(0);
     } else if (chunk->type == Sctp_Heartbeat) {
-      SctpPacket response;
-      response.sourcePort = sctpPacket.destionationPort;
-      response.destionationPort = sctpPacket.sourcePort;
-      response.verificationTag = client->sctpVerificationTag;
-
-      SctpChunk rc;
-      rc.type = Sctp_HeartbeatAck;
-      rc.flags = 0;
-      rc.length = chunk->length;
-      rc.as.heartbeat.heartbeatInfoLen = chunk->as.heartbeat.heartbeatInfoLen;
-      rc.as.heartbeat.heartbeatInfo = chunk->as.heartbeat.heartbeatInfo;
+      WuClientRefreshTtl(wu, client);
 
-      client->ttl = kMaxClientTtl;
+      // The ack echoes the heartbeat info, it has to fit a packet of its own.
+      if (kSctpHeaderLength + SctpSerializedChunkLength(chunk) >
+          size_t(kMaxSctpPacketLength)) {
+        continue;
+      }
 
-      WuSendSctp(wu, client, &response, &rc, 1);
+      SctpChunk* rc = &control[numControl++];
+      rc->type = Sctp_HeartbeatAck;
+      rc->flags = 0;
+      rc->length = uint16_t(chunk->as.heartbeat.heartbeatInfoLen + 8);
+      rc->as.heartbeat.heartbeatInfoLen = chunk->as.heartbeat.heartbeatInfoLen;
+      rc->as.heartbeat.heartbeatInfo = chunk->as.heartbeat.heartbeatInfo;
     } else if (chunk->type == Sctp_HeartbeatAck) {
-      client->ttl = kMaxClientTtl;
+      WuClientRefreshTtl(wu, client);
+
+      // The heartbeat info is the tick time the heartbeat was sent at.
+      double sentAt = 0.0;
+      if (chunk->as.heartbeat.heartbeatInfoLen == sizeof(sentAt)) {
+        memcpy(&sentAt, chunk->as.heartbeat.heartbeatInfo, sizeof(sentAt));
+        const int64_t rtt = int64_t((MsNow() * 0.001 - sentAt) * 1e6);
+        WU_TRACE2(heartbeat_rtt, client, rtt);
+        WuClientRecord(wu, client, WuRecord_HeartbeatRtt, 0, uint32_t(rtt));
+      }
     } else if (chunk->type == Sctp_Abort) {
       client->state = WuClient_WaitingRemoval;
       return;
     } else if (chunk->type == Sctp_Sack) {
-      auto* sack = &chunk->as.sack;
-      if (sack->numGapAckBlocks > 0) {
-        SctpPacket fwdResponse;
-        fwdResponse.sourcePort = sctpPacket.destionationPort;
-        fwdResponse.destionationPort = sctpPacket.sourcePort;
-        fwdResponse.verificationTag = client->sctpVerificationTag;
-
-        SctpChunk fwdTsnChunk;
-        fwdTsnChunk.type = SctpChunk_ForwardTsn;
-        fwdTsnChunk.flags = 0;
-        fwdTsnChunk.length = SctpChunkLength(4);
-        fwdTsnChunk.as.forwardTsn.newCumulativeTsn = client->tsn;
-        WuSendSctp(wu, client, &fwdResponse, &fwdTsnChunk, 1);
+      WuClientHandleAck(wu, client, chunk->as.sack.cumulativeTsnAck,
+                        chunk->as.sack.advRecvWindow);
+
+      // Our DATA is unreliable, tell the peer to stop waiting for the gaps.
+      if (chunk->as.sack.numGapAckBlocks > 0) {
+        needForwardTsn = true;
       }
+    } else if (chunk->type == SctpChunk_ForwardTsn) {
+      wu->stats.forwardTsnsIn++;
+      SctpTsnTrackerForward(&client->receivedTsns,
+                            chunk->as.forwardTsn.newCumulativeTsn);
+      needSack = true;
     }
   }
-}
 
-static void WuReceiveDTLSPacket(Wu* wu, const uint8_t* data, size_t length,
-                                const WuAddress* address) {
-  WuClient* client = WuFindClient(wu, address);
-  if (!client) {
-    return;
+  if (needForwardTsn) {
+    wu->stats.forwardTsnsOut++;
+    SctpChunk* rc = &control[numControl++];
+    rc->type = SctpChunk_ForwardTsn;
+    rc->flags = 0;
+    rc->length = SctpChunkLength(4);
+    // The last TSN sent, client->tsn hasn't been used yet.
+    rc->as.forwardTsn.newCumulativeTsn = client->tsn - 1;
+    WuClientAbandonInFlight(wu, client);
+  }
+
+  uint16_t gapBlocks[2 * kSctpMaxGapBlocks];
+  if (needSack) {
+    const uint16_t numGapBlocks = uint16_t(SctpTsnTrackerGapBlocks(
+        &client->receivedTsns, gapBlocks, kSctpMaxGapBlocks));
+
+    SctpChunk* rc = &control[numControl++];
+    rc->type = Sctp_Sack;
+    rc->flags = 0;
+    rc->length = SctpChunkLength(12 + 4 * numGapBlocks + 4 * numDupTsns);
+    rc->as.sack.cumulativeTsnAck = client->receivedTsns.cumulativeTsn;
+    rc->as.sack.advRecvWindow = kSctpDefaultBufferSpace;
+    rc->as.sack.numGapAckBlocks = numGapBlocks;
+    rc->as.sack.numDupTsn = numDupTsns;
+    rc->as.sack.gapAckBlocks = gapBlocks;
+    rc->as.sack.dupTsns = dupTsns;
+  }
+
+  for (int32_t i = 0; i < numData; i++) {
+    control[numControl++] = data[i];
   }
 
+  // Heartbeat acks echo up to a packet's worth each, what doesn't fit the
+  // current packet starts the next one.
+  int32_t first = 0;
+  size_t packetLength = kSctpHeaderLength;
+  for (int32_t i = 0; i < numControl; i++) {
+    const size_t chunkLength = SctpSerializedChunkLength(&control[i]);
+    if (i > first &&
+        packetLength + chunkLength > size_t(kMaxSctpPacketLength)) {
+      WuSendSctp(wu, client, &response, control + first, i - first);
+      first = i;
+      packetLength = kSctpHeaderLength;
+    }
+    packetLength += chunkLength;
+  }
+
+  if (numControl > first) {
+    WuSendSctp(wu, client, &response, control + first, numControl - first);
+  }
+}
+
+static void WuReceiveDTLSPacket(Wu* wu, WuClient* client, const uint8_t* data,
+                                size_t length, uint64_t start) {
+  uint64_t sctpCycles = 0;
+
   BIO_write(client->inBio, data, length);
 
   if (!SSL_is_init_finished(client->ssl)) {
+    if (SSL_in_before(client->ssl)) {
+      WU_TRACE1(dtls_handshake_start, client);
+      WuClientRecord(wu, client, WuRecord_DtlsHandshakeStart);
+    }
+
     int r = SSL_do_handshake(client->ssl);
 
+    if (SSL_is_init_finished(client->ssl)) {
+      WU_TRACE1(dtls_handshake_done, client);
+      WuClientRecord(wu, client, WuRecord_DtlsHandshakeDone);
+      wu->stats.handshakes++;
+    }
+
     if (r <= 0) {
       r = SSL_get_error(client->ssl, r);
       if (SSL_ERROR_WANT_READ == r) {
         WuClientSendPendingDTLS(wu, client);
       } else if (SSL_ERROR_NONE != r) {
+        WuClientRecord(wu, client, WuRecord_DtlsError, 0, uint32_t(r));
         char* error = ERR_error_string(r, NULL);
         if (error) {
           WuReportError(wu, error);
@@ -416,21 +1038,72 @@ static void WuReceiveDTLSPacket(Wu* wu, const uint8_t* data, size_t length,
       int bytes = SSL_read(client->ssl, receiveBuffer, sizeof(receiveBuffer));
 
       if (bytes > 0) {
-        uint8_t* buf = (uint8_t*)WuArenaAcquire(wu->arena, bytes);
-        memcpy(buf, receiveBuffer, bytes);
-        WuHandleSctp(wu, client, buf, bytes);
+        const uint64_t sctpStart = CycleCounter();
+        WuHandleSctp(wu, client, receiveBuffer, bytes);
+        sctpCycles += CycleCounter() - sctpStart;
       }
     }
+
+    // Acks and keep-alives don't wake a client, drop the read buffer they
+    // brought back.
+    if (WuClientIsHibernated(client)) {
+      WuClientFreeSslBuffers(client);
+    }
+  }
+
+  client->cycles[WuCost_Dtls] += CycleCounter() - start - sctpCycles;
+  client->cycles[WuCost_Sctp] += sctpCycles;
+}
+
+// Established clients are serviced on arrival. Handshake datagrams are
+// queued and processed from WuUpdate within WuConf::handshakeBudget, so that
+// a burst of new connections doesn't hold up their data.
+static void WuHandleDtls(Wu* wu, const uint8_t* data, int32_t length,
+                         const WuAddress* address, uint64_t start) {
+  WuClient* client = WuFindClient(wu, address);
+  if (!client) {
+    wu->stats.unattributedCycles += CycleCounter() - start;
+    return;
+  }
+
+  if (client->ssl && SSL_is_init_finished(client->ssl)) {
+    WuReceiveDTLSPacket(wu, client, data, size_t(length), start);
+    return;
+  }
+
+  if (length > kMaxHandshakeDatagramLength ||
+      wu->handshakeQueue->length >= wu->maxQueuedHandshakes) {
+    wu->stats.droppedHandshakeDatagrams++;
+    return;
+  }
+
+  WuHandshakeDatagram datagram;
+  datagram.client = client;
+  datagram.clientId = client->id;
+  datagram.length = length;
+  memcpy(datagram.data, data, length);
+  if (WuQueuePush(wu->handshakeQueue, &datagram)) {
+    wu->stats.queuedHandshakeDatagrams++;
+  } else {
+    wu->stats.droppedHandshakeDatagrams++;
   }
+  client->cycles[WuCost_Dtls] += CycleCounter() - start;
 }
 
 static void WuHandleStun(Wu* wu, const StunPacket* packet,
-                         const WuAddress* remote) {
+                         const WuAddress* remote, uint64_t start) {
   WuClient* client =
       WuFindClientByCreds(wu, &packet->serverUser, &packet->remoteUser);
 
   if (!client) {
     // TODO: Send unauthorized
+    wu->stats.unattributedCycles += CycleCounter() - start;
+    return;
+  }
+
+  if (client->state == WuClient_WaitingBinding &&
+      !WuClientStartDtls(wu, client)) {
+    WuReportError(wu, "failed to create SSL object");
     return;
   }
 
@@ -445,19 +1118,27 @@ static void WuHandleStun(Wu* wu, const StunPacket* packet,
 
   uint8_t stunResponse[512];
   size_t serializedSize =
-      SerializeStunPacket(&outPacket, client->serverPassword.identifier,
-                          client->serverPassword.length, stunResponse, 512);
+      SerializeStunPacket(&outPacket, client->serverPassword,
+                          kServerPasswordLength, stunResponse, 512);
 
   client->localSctpPort = remote->port;
   client->address = *remote;
 
-  wu->writeUdpData(stunResponse, serializedSize, client, wu->userData);
+  WU_TRACE3(stun_handled, client, remote->host, remote->port);
+  WuClientRecord(wu, client, WuRecord_StunBinding, 0, remote->port);
+  WuWriteUdp(wu, client, stunResponse, int32_t(serializedSize));
+  client->cycles[WuCost_Stun] += CycleCounter() - start;
 }
 
 static void WuPurgeDeadClients(Wu* wu) {
-  for (int32_t i = 0; i < wu->numClients; i++) {
+  for (int32_t i = 0; i < wu->numActiveClients; i++) {
     WuClient* client = wu->clients[i];
-    if (client->ttl <= 0.0 || client->state == WuClient_WaitingRemoval) {
+    if (client->expiresAt <= wu->time ||
+        client->state == WuClient_WaitingRemoval) {
+      if (client->expiresAt <= wu->time) {
+        WuClientRecord(wu, client, WuRecord_Expired);
+      }
+
       WuEvent evt;
       evt.type = WuEvent_ClientLeave;
       evt.client = client;
@@ -466,9 +1147,23 @@ static void WuPurgeDeadClients(Wu* wu) {
   }
 }
 
-static int32_t WuCryptoInit(Wu* wu) {
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+static void WuWriteKeyLog(const SSL* ssl, const char* line) {
+  FILE* file = (FILE*)SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+  fprintf(file, "%s\n", line);
+  fflush(file);
+}
+#endif
+
+static int32_t WuCryptoInit(Wu* wu, const WuConf* conf) {
   static bool initDone = false;
 
+  // Must run before the first OpenSSL allocation in the process.
+  if (conf->installSslAllocator &&
+      !WuInstallSslAllocator(&conf->allocator)) {
+    WuReportError(wu, "failed to install OpenSSL allocator");
+  }
+
   if (!initDone) {
     SSL_library_init();
     SSL_load_error_strings();
@@ -517,40 +1212,116 @@ static int32_t WuCryptoInit(Wu* wu) {
   }
 
   SSL_CTX_set_options(wu->sslCtx, SSL_OP_NO_QUERY_MTU);
-
+  SSL_CTX_set_options(wu->sslCtx, SSL_OP_SINGLE_ECDH_USE);
+  SSL_CTX_set_options(wu->sslCtx,
+                      SSL_OP_NO_SESSION_RESUMPTION_ON_RENEGOTIATION);
+
+  // NSS key log format, lets Wireshark decrypt captured sessions.
+  if (conf->keyLogFile) {
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    FILE* keyLog = fopen(conf->keyLogFile, "a");
+    if (keyLog) {
+      SSL_CTX_set_app_data(wu->sslCtx, keyLog);
+      SSL_CTX_set_keylog_callback(wu->sslCtx, WuWriteKeyLog);
+    } else {
+      WuReportError(wu, "failed to open key log file");
+    }
+#else
+    WuReportError(wu, "key logging requires OpenSSL 1.1.1");
+#endif
+  }
+
+  // ECDHE on P-256 only, set on the context so clients share it.
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+  SSL_CTX_set_ecdh_auto(wu->sslCtx, 1);
+#endif
+  if (SSL_CTX_set1_curves_list(wu->sslCtx, "P-256") != 1) {
+    ERR_print_errors_fp(stderr);
+    return 0;
+  }
+
   memcpy(wu->certFingerprint, cert.fingerprint, sizeof(cert.fingerprint));
 
   return 1;
 }
 
+int32_t WuConfMaxClients(const WuConf* conf) {
+  return conf->maxClients <= 0 ? kDefaultMaxClients : conf->maxClients;
+}
+
 int32_t WuInit(Wu* wu, const WuConf* conf) {
-  memset(wu, 0, sizeof(Wu));
-  wu->arena = (WuArena*)calloc(1, sizeof(WuArena));
-  WuArenaInit(wu->arena, 1 << 20);
+  *wu = Wu();
+  wu->errorCallback = DefaultErrorCallback;
+  wu->writeUdpData = WriteNothing;
+
+  if (!WuAllocatorValid(&conf->allocator)) {
+    WuReportError(wu, "allocator functions must be set together");
+    return 0;
+  }
+
+  wu->allocator = conf->allocator;
+  wu->arena = (WuArena*)WuCalloc(&wu->allocator, 1, sizeof(WuArena));
+  WuArenaInit(wu->arena, &wu->allocator, 1 << 20);
 
   wu->time = MsNow() * 0.001;
   wu->dt = 0.0;
   strncpy(wu->host, conf->host, sizeof(wu->host));
   wu->port = atoi(conf->port);
-  wu->pendingEvents = WuQueueCreate(sizeof(WuEvent), 1024);
-
-  wu->errorCallback = DefaultErrorCallback;
-  wu->writeUdpData = WriteNothing;
+  wu->pendingEvents = WuQueueCreate(&wu->allocator, sizeof(WuEvent), 1024);
+  wu->handshakeQueue =
+      WuQueueCreate(&wu->allocator, sizeof(WuHandshakeDatagram),
+                    kInitialHandshakeQueueSize);
+  wu->handshakeBudget = conf->handshakeBudget;
+  wu->maxQueuedHandshakes = conf->handshakeQueueSize;
+  wu->recorder = (WuRecorder*)WuCalloc(&wu->allocator, 1, sizeof(WuRecorder));
+  WuRecorderInit(wu->recorder, &wu->allocator, conf->recorderSize, wu->time);
+
+  wu->overloadBudget = conf->overloadBudget;
+  memcpy(wu->overloadThresholds, conf->overloadThresholds,
+         sizeof(wu->overloadThresholds));
+
+  if (conf->commandQueueSize > 0) {
+    wu->commands =
+        WuCommandQueueCreate(&wu->allocator, conf->commandQueueSize);
+    if (!wu->commands) {
+      WuReportError(wu, "failed to allocate the command queue");
+      return 0;
+    }
+  }
 
-  if (!WuCryptoInit(wu)) {
+  if (!WuCryptoInit(wu, conf)) {
     WuReportError(wu, "failed to init crypto");
     return 0;
   }
 
-  wu->maxClients = conf->maxClients <= 0 ? 256 : conf->maxClients;
+  wu->maxClients = WuConfMaxClients(conf);
   wu->numClients = 0;
-  wu->clientPool = WuPoolCreate(sizeof(WuClient), wu->maxClients);
-  wu->clients = (WuClient**)calloc(wu->maxClients, sizeof(WuClient*));
+  const int32_t chunkSize = conf->clientChunkSize <= 0
+                                ? kDefaultClientChunkSize
+                                : conf->clientChunkSize;
+  wu->clientPool = WuPoolCreate(&wu->allocator, sizeof(WuClient), chunkSize,
+                                wu->maxClients);
+  if (!wu->clientPool ||
+      !WuReserveClients(wu, WuPoolCapacity(wu->clientPool))) {
+    WuReportError(wu, "failed to allocate clients");
+    return 0;
+  }
+
+  wu->hibernateTimeout = conf->hibernateTimeout;
+  wu->dtlsRetransmitTimeout = conf->dtlsRetransmitTimeout;
+  wu->bindingTimeout = conf->bindingTimeout;
+  wu->sendHighWatermark = conf->sendHighWatermark;
+  wu->timeSync = conf->timeSync;
 
   return 1;
 }
 
 static void WuSendHeartbeat(Wu* wu, WuClient* client) {
+  if (client->bufferedAmount > 0 &&
+      wu->time - client->ackedAt >= heartbeatInterval) {
+    WuClientAbandonInFlight(wu, client);
+  }
+
   SctpPacket packet;
   packet.sourcePort = wu->port;
   packet.destionationPort = client->remoteSctpPort;
@@ -566,22 +1337,146 @@ static void WuSendHeartbeat(Wu* wu, WuClient* client) {
   WuSendSctp(wu, client, &packet, &rc, 1);
 }
 
+// Pushes the heartbeat back while overloaded, as long as its answer can still
+// arrive before the client expires.
+static bool WuDeferHeartbeat(Wu* wu, WuClient* client) {
+  const double latest = client->expiresAt - kHeartbeatDeferMargin;
+  if (wu->overloadLevel < WuOverload_DeferHeartbeats || wu->time >= latest) {
+    return false;
+  }
+
+  client->heartbeatAt = Min(wu->time + heartbeatInterval, latest);
+  wu->stats.overloadDeferredHeartbeats++;
+  return true;
+}
+
 static void WuUpdateClients(Wu* wu) {
   double t = MsNow() * 0.001;
   wu->dt = t - wu->time;
   wu->time = t;
 
-  for (int32_t i = 0; i < wu->numClients; i++) {
+  // Hibernated clients only have their timers serviced. Expired ones are
+  // woken up so that they are purged along with the active clients.
+  while (wu->numHibernatedClients > 0) {
+    WuClient* client = wu->hibernatedClients[0];
+    if (WuClientDeadline(client) > wu->time) {
+      break;
+    }
+
+    if (client->expiresAt <= wu->time) {
+      WuWakeClient(wu, client);
+      continue;
+    }
+
+    if (!WuDeferHeartbeat(wu, client)) {
+      client->heartbeatAt = wu->time + heartbeatInterval;
+      WuSendHeartbeat(wu, client);
+    }
+    WuHeapSiftDown(wu, 0);
+  }
+
+  for (int32_t i = 0; i < wu->numActiveClients;) {
     WuClient* client = wu->clients[i];
-    client->ttl -= wu->dt;
-    client->nextHeartbeat -= wu->dt;
 
-    if (client->nextHeartbeat <= 0.0) {
-      client->nextHeartbeat = heartbeatInterval;
+    if (client->state == WuClient_WaitingBinding) {
+      i++;
+      continue;
+    }
+
+    if (client->heartbeatAt <= wu->time && !WuDeferHeartbeat(wu, client)) {
+      client->heartbeatAt = wu->time + heartbeatInterval;
       WuSendHeartbeat(wu, client);
     }
 
+    if (client->state == WuClient_DTLSHandshake &&
+        wu->dtlsRetransmitTimeout > 0.0) {
+      WuClientHandleDtlsTimeout(wu, client);
+    }
+
     WuClientSendPendingDTLS(wu, client);
+
+    if (wu->hibernateTimeout > 0.0 &&
+        client->state == WuClient_DataChannelOpen &&
+        client->expiresAt > wu->time &&
+        wu->time - client->lastDataAt >= wu->hibernateTimeout) {
+      // Swaps the last active client into slot i.
+      WuHibernateClient(wu, client);
+      continue;
+    }
+
+    i++;
+  }
+}
+
+static void WuShrinkClients(Wu* wu) {
+  // Keep one empty chunk around so that a client count oscillating around a
+  // chunk boundary doesn't allocate and free on every join.
+  if (WuPoolEmptyChunks(wu->clientPool) < 2) {
+    return;
+  }
+
+  WuPoolShrink(wu->clientPool, 1);
+  WuReserveClients(wu, WuPoolCapacity(wu->clientPool));
+}
+
+// A client referred to from a queue may have left and its slot been reused
+// or released since.
+static bool WuClientIsLive(const Wu* wu, const WuClient* client, uint32_t id) {
+  return WuPoolContains(wu->clientPool, client) &&
+         client->index < wu->numClients &&
+         wu->clients[client->index] == client && client->id == id;
+}
+
+static void WuRunCommand(const WuCommand* command, const uint8_t* data,
+                         void* userData) {
+  Wu* wu = (Wu*)userData;
+  WuClient* client = command->client;
+
+  if (!WuClientIsLive(wu, client, command->clientId)) {
+    wu->stats.droppedCommands++;
+    return;
+  }
+
+  int32_t result = 0;
+  switch (command->type) {
+    case WuCommand_SendText:
+      result = WuSendText(wu, client, (const char*)data, command->length);
+      break;
+    case WuCommand_SendBinary:
+      result = WuSendBinary(wu, client, data, command->length);
+      break;
+    case WuCommand_RemoveClient:
+      WuRemoveClient(wu, client);
+      break;
+    default:
+      break;
+  }
+
+  if (result < 0) {
+    wu->stats.droppedCommands++;
+  }
+}
+
+// At least one datagram is processed per tick so that handshakes progress
+// whatever the budget.
+static void WuProcessHandshakes(Wu* wu) {
+  const double deadline = MsNow() * 0.001 + wu->handshakeBudget;
+  WuHandshakeDatagram datagram;
+
+  while (WuQueuePop(wu->handshakeQueue, &datagram)) {
+    if (WuClientIsLive(wu, datagram.client, datagram.clientId)) {
+      WuReceiveDTLSPacket(wu, datagram.client, datagram.data,
+                          size_t(datagram.length), CycleCounter());
+    } else {
+      wu->stats.droppedHandshakeDatagrams++;
+    }
+
+    if (wu->handshakeBudget > 0.0 && MsNow() * 0.001 >= deadline) {
+      if (wu->handshakeQueue->length > 0) {
+        wu->stats.handshakeBudgetHits++;
+      }
+      break;
+    }
   }
 }
 
@@ -590,24 +1485,48 @@ int32_t WuUpdate(Wu* wu, WuEvent* evt) {
     return 1;
   }
 
+  if (wu->commands) {
+    WuCommandQueueDrain(wu->commands, WuRunCommand, wu);
+  }
+
+  WuProcessHandshakes(wu);
+
   WuUpdateClients(wu);
   WuArenaReset(wu->arena);
+  WuShrinkClients(wu);
 
   WuPurgeDeadClients(wu);
 
   return 0;
 }
 
-static int32_t WuSendData(Wu* wu, WuClient* client, const uint8_t* data,
-                          int32_t length, DataChanProtoIdentifier proto) {
-  if (client->state < WuClient_DataChannelOpen) {
-    return -1;
+// A single DATA chunk packet serialized once and sent to any number of
+// clients, patching in the destination port, verification tag, TSN and
+// checksum for each.
+struct WuPreparedData {
+  uint8_t packet[kMaxSctpPacketLength];
+  int32_t length;
+  int32_t messageLength;
+};
+
+static int32_t WuPrepareData(Wu* wu, WuPreparedData* prepared,
+                             const iovec* buffers, int32_t count,
+                             DataChanProtoIdentifier proto) {
+  // Checked before adding so that huge iov_len values can't wrap the sum.
+  size_t total = 0;
+  for (int32_t i = 0; i < count; i++) {
+    if (buffers[i].iov_len > size_t(kMaxMessageLength) - total) {
+      return 0;
+    }
+    total += buffers[i].iov_len;
   }
 
+  const int32_t length = int32_t(total);
+
   SctpPacket packet;
   packet.sourcePort = wu->port;
-  packet.destionationPort = client->remoteSctpPort;
-  packet.verificationTag = client->sctpVerificationTag;
+  packet.destionationPort = 0;
+  packet.verificationTag = 0;
 
   SctpChunk rc;
   rc.type = Sctp_Data;
@@ -615,17 +1534,76 @@ static int32_t WuSendData(Wu* wu, WuClient* client, const uint8_t* data,
   rc.length = SctpDataChunkLength(length);
 
   auto* dc = &rc.as.data;
-  dc->tsn = client->tsn++;
+  dc->tsn = 0;
   dc->streamId = 0;  // TODO: Does it matter?
   dc->streamSeq = 0;
   dc->protoId = proto;
-  dc->userData = data;
+  dc->userData = NULL;
   dc->userDataLength = length;
+  dc->userDataV = buffers;
+  dc->userDataVCount = count;
+
+  prepared->length = int32_t(SerializeSctpPacket(
+      &packet, &rc, 1, prepared->packet, sizeof(prepared->packet)));
+  prepared->messageLength = length;
+  return 1;
+}
+
+static int32_t WuSendPrepared(Wu* wu, WuClient* client,
+                              WuPreparedData* prepared) {
+  if (client->state < WuClient_DataChannelOpen) {
+    return -1;
+  }
+
+  // The peer would drop what doesn't fit its receive window.
+  if (!WuClientCanSend(client, prepared->messageLength)) {
+    client->sendBlocked = true;
+    return -1;
+  }
+
+  // Outbound data keeps a client active like inbound data does, so that one
+  // that only receives keeps its record buffers between messages.
+  client->lastDataAt = wu->time;
+  WuWakeClient(wu, client);
+
+  const uint32_t tsn = client->tsn++;
+  SctpPatchDataPacket(prepared->packet, prepared->length,
+                      client->remoteSctpPort, client->sctpVerificationTag, tsn);
+
+  WuClientRecord(wu, client, WuRecord_SctpChunkOut, Sctp_Data, tsn,
+                 uint16_t(SctpDataChunkLength(prepared->messageLength)));
+  TLSSend(wu, client, prepared->packet, prepared->length);
+  WuClientTrackSent(wu, client, tsn, prepared->messageLength);
+
+  if (client->bufferedAmount >= wu->sendHighWatermark) {
+    client->sendBlocked = true;
+  }
 
-  WuSendSctp(wu, client, &packet, &rc, 1);
   return 0;
 }
 
+static int32_t WuSendDataV(Wu* wu, WuClient* client, const iovec* buffers,
+                           int32_t count, DataChanProtoIdentifier proto) {
+  if (client->state < WuClient_DataChannelOpen) {
+    return -1;
+  }
+
+  WuPreparedData prepared;
+  if (!WuPrepareData(wu, &prepared, buffers, count, proto)) {
+    return -1;
+  }
+
+  return WuSendPrepared(wu, client, &prepared);
+}
+
+static int32_t WuSendData(Wu* wu, WuClient* client, const uint8_t* data,
+                          int32_t length, DataChanProtoIdentifier proto) {
+  iovec buffer;
+  buffer.iov_base = (void*)data;
+  buffer.iov_len = size_t(length);
+  return WuSendDataV(wu, client, &buffer, 1, proto);
+}
+
 int32_t WuSendText(Wu* wu, WuClient* client, const char* text, int32_t length) {
   return WuSendData(wu, client, (const uint8_t*)text, length, DCProto_String);
 }
@@ -635,36 +1613,41 @@ int32_t WuSendBinary(Wu* wu, WuClient* client, const uint8_t* data,
   return WuSendData(wu, client, data, length, DCProto_Binary);
 }
 
+int32_t WuSendBinaryV(Wu* wu, WuClient* client, const iovec* buffers,
+                      int32_t count) {
+  return WuSendDataV(wu, client, buffers, count, DCProto_Binary);
+}
+
 SDPResult WuExchangeSDP(Wu* wu, const char* sdp, int32_t length) {
   ICESdpFields iceFields;
-  if (!ParseSdp(sdp, length, &iceFields)) {
+  if (!ParseSdp(sdp, length, &iceFields) ||
+      iceFields.ufrag.length > kMaxRemoteUserLength) {
     return {WuSDPStatus_InvalidSDP, NULL, NULL, 0};
   }
 
+  if (wu->overloadLevel >= WuOverload_PauseAdmissions) {
+    wu->stats.overloadRefusedOffers++;
+    return {WuSDPStatus_Overloaded, NULL, NULL, 0};
+  }
+
   WuClient* client = WuNewClient(wu);
 
   if (!client) {
     return {WuSDPStatus_MaxClients, NULL, NULL, 0};
   }
 
-  client->serverUser.length = 4;
-  WuRandomString((char*)client->serverUser.identifier,
-                 client->serverUser.length);
-  client->serverPassword.length = 24;
-  WuRandomString((char*)client->serverPassword.identifier,
-                 client->serverPassword.length);
-  memcpy(client->remoteUser.identifier, iceFields.ufrag.value,
-         Min(iceFields.ufrag.length, kMaxStunIdentifierLength));
-  client->remoteUser.length = iceFields.ufrag.length;
-  memcpy(client->remoteUserPassword.identifier, iceFields.password.value,
-         Min(iceFields.password.length, kMaxStunIdentifierLength));
+  WuRandomString((char*)client->serverUser, kServerUserLength);
+  WuRandomString((char*)client->serverPassword, kServerPasswordLength);
+  memcpy(client->remoteUser, iceFields.ufrag.value, iceFields.ufrag.length);
+  client->remoteUserLength = uint8_t(iceFields.ufrag.length);
+  WuClientRecord(wu, client, WuRecord_ClientCreated);
 
   int sdpLength = 0;
   const char* responseSdp = GenerateSDP(
       wu->arena, wu->certFingerprint, wu->host, wu->port,
-      (char*)client->serverUser.identifier, client->serverUser.length,
-      (char*)client->serverPassword.identifier, client->serverPassword.length,
-      &iceFields, &sdpLength);
+      (char*)client->serverUser, kServerUserLength,
+      (char*)client->serverPassword, kServerPasswordLength, &iceFields,
+      &sdpLength);
 
   if (!responseSdp) {
     return {WuSDPStatus_Error, NULL, NULL, 0};
@@ -677,11 +1660,21 @@ void WuSetUserData(Wu* wu, void* userData) { wu->userData = userData; }
 
 void WuHandleUDP(Wu* wu, const WuAddress* remote, const uint8_t* data,
                  int32_t length) {
+  WU_TRACE3(datagram_received, remote->host, remote->port, length);
+  wu->stats.datagramsIn++;
+  wu->stats.bytesIn += length;
+  const uint64_t start = CycleCounter();
+
+  // Demultiplexed on the first byte (RFC 7983), TURN channels, ZRTP and
+  // RTP/RTCP aren't used by data channels.
+  const uint8_t first = length > 0 ? data[0] : 0xFF;
   StunPacket stunPacket;
-  if (ParseStun(data, length, &stunPacket)) {
-    WuHandleStun(wu, &stunPacket, remote);
+  if (first <= 3 && ParseStun(data, length, &stunPacket)) {
+    WuHandleStun(wu, &stunPacket, remote, start);
+  } else if (first >= 20 && first <= 63) {
+    WuHandleDtls(wu, data, length, remote, start);
   } else {
-    WuReceiveDTLSPacket(wu, data, length, remote);
+    wu->stats.unclassifiedDatagrams++;
   }
 }
 
@@ -691,6 +1684,136 @@ void WuSetUDPWriteFunction(Wu* wu, WuWriteFn write) {
 
 WuAddress WuClientGetAddress(const WuClient* client) { return client->address; }
 
+int32_t WuClientIsHibernated(const WuClient* client) {
+  return client->heapIndex >= 0;
+}
+
+WuClientState WuClientGetState(const WuClient* client) {
+  return client->state;
+}
+
+int32_t WuClientGetBufferedAmount(const WuClient* client) {
+  return client->bufferedAmount;
+}
+
+uint32_t WuClientGetId(const WuClient* client) { return client->id; }
+
+int32_t WuClientGetTimeSync(const WuClient* client, WuTimeSync* sync) {
+  *sync = client->timeSync;
+  return sync->samples > 0 ? 1 : 0;
+}
+
+void WuClientGetCost(const WuClient* client, WuClientCost* cost) {
+  cost->client = (WuClient*)client;
+  cost->total = 0;
+  for (int32_t i = 0; i < WuCost_Count; i++) {
+    cost->cycles[i] = client->cycles[i];
+    cost->total += client->cycles[i];
+  }
+}
+
+int32_t WuTopClientsByCost(const Wu* wu, WuClientCost* top, int32_t n) {
+  int32_t count = 0;
+
+  // n is expected to be small, keep top sorted by insertion.
+  for (int32_t i = 0; i < wu->numClients; i++) {
+    WuClientCost cost;
+    WuClientGetCost(wu->clients[i], &cost);
+
+    if (count == n && (n == 0 || cost.total <= top[n - 1].total)) {
+      continue;
+    }
+
+    int32_t j = count < n ? count++ : n - 1;
+    while (j > 0 && top[j - 1].total < cost.total) {
+      top[j] = top[j - 1];
+      j--;
+    }
+
+    top[j] = cost;
+  }
+
+  return count;
+}
+
+void WuGetMemoryStats(const Wu* wu, WuMemoryStats* stats) {
+  memset(stats, 0, sizeof(WuMemoryStats));
+  stats->clientPool = WuPoolBytes(wu->clientPool);
+  stats->clientIndex = 2 * size_t(wu->clientsCapacity) * sizeof(WuClient*);
+  stats->clientStructs = size_t(wu->numClients) * sizeof(WuClient);
+  stats->arena = sizeof(WuArena) + size_t(wu->arena->capacity);
+  stats->arenaPeak = size_t(wu->arena->highWater);
+  stats->eventQueue = sizeof(WuQueue) + size_t(wu->pendingEvents->capacity) *
+                                            wu->pendingEvents->itemSize;
+  stats->handshakeQueue =
+      sizeof(WuQueue) + size_t(wu->handshakeQueue->capacity) *
+                            wu->handshakeQueue->itemSize;
+  stats->recorder = sizeof(WuRecorder) +
+                    (wu->recorder->records ? size_t(wu->recorder->mask + 1) *
+                                                 sizeof(WuRecord)
+                                           : 0);
+  stats->commandQueue =
+      wu->commands ? sizeof(WuCommandQueue) + wu->commands->capacity : 0;
+  stats->topics = size_t(wu->topicsCapacity) * sizeof(WuTopic*);
+  for (int32_t i = 0; i < wu->numTopics; i++) {
+    stats->topics += WuTopicBytes(wu->topics[i]);
+  }
+  stats->ssl = WuSslAllocatedBytes();
+
+  // clientStructs and arenaPeak are already part of the pool and arena.
+  stats->total = sizeof(Wu) + stats->clientPool + stats->clientIndex +
+                 stats->arena + stats->eventQueue + stats->handshakeQueue +
+                 stats->recorder +
+                 stats->commandQueue + stats->topics +
+                 (stats->ssl > 0 ? size_t(stats->ssl) : 0);
+}
+
+void WuResetClientCosts(Wu* wu) {
+  for (int32_t i = 0; i < wu->numClients; i++) {
+    memset(wu->clients[i]->cycles, 0, sizeof(wu->clients[i]->cycles));
+    wu->clients[i]->shedMark = 0;
+    wu->clients[i]->shedCycles = 0;
+  }
+
+  wu->stats.unattributedCycles = 0;
+}
+
+const char* WuGetCostUnit() { return WU_CYCLE_UNIT; }
+
+int32_t WuDumpRecords(const Wu* wu, uint32_t clientId, WuRecordFn fn,
+                      void* userData) {
+  return WuRecorderForEach(wu->recorder, clientId, fn, userData);
+}
+
+void WuSetLeaveRecordsCallback(Wu* wu, WuRecordFn fn, void* userData) {
+  wu->leaveRecordsFn = fn;
+  wu->leaveRecordsUserData = userData;
+}
+
+const char* WuRecordTypeName(uint8_t type) {
+  static const char* const names[] = {"client_created",
+                                      "stun_binding",
+                                      "dtls_handshake_start",
+                                      "dtls_handshake_done",
+                                      "dtls_error",
+                                      "sctp_chunk_in",
+                                      "sctp_chunk_out",
+                                      "heartbeat_rtt",
+                                      "data_channel_open",
+                                      "hibernate",
+                                      "wake",
+                                      "expired",
+                                      "leave",
+                                      "dtls_retransmit",
+                                      "shed"};
+
+  if (type >= sizeof(names) / sizeof(names[0])) {
+    return "unknown";
+  }
+
+  return names[type];
+}
+
 void WuSetErrorCallback(Wu* wu, WuErrorFn callback) {
   if (callback) {
     wu->errorCallback = callback;
@@ -698,3 +1821,221 @@ void WuSetErrorCallback(Wu* wu, WuErrorFn callback) {
     wu->errorCallback = DefaultErrorCallback;
   }
 }
+
+int32_t WuEnqueueSendText(Wu* wu, WuClient* client, uint32_t clientId,
+                          const char* text, int32_t length) {
+  if (!wu->commands) {
+    return 0;
+  }
+
+  return WuCommandQueuePush(wu->commands, WuCommand_SendText, client, clientId,
+                            (const uint8_t*)text, length);
+}
+
+int32_t WuEnqueueSendBinary(Wu* wu, WuClient* client, uint32_t clientId,
+                            const uint8_t* data, int32_t length) {
+  if (!wu->commands) {
+    return 0;
+  }
+
+  return WuCommandQueuePush(wu->commands, WuCommand_SendBinary, client,
+                            clientId, data, length);
+}
+
+int32_t WuEnqueueRemoveClient(Wu* wu, WuClient* client, uint32_t clientId) {
+  if (!wu->commands) {
+    return 0;
+  }
+
+  return WuCommandQueuePush(wu->commands, WuCommand_RemoveClient, client,
+                            clientId, NULL, 0);
+}
+
+WuTopic* WuCreateTopic(Wu* wu) {
+  if (wu->numTopics == wu->topicsCapacity) {
+    const int32_t capacity = wu->topicsCapacity ? wu->topicsCapacity * 2 : 8;
+    WuTopic** topics = (WuTopic**)WuRealloc(&wu->allocator, wu->topics,
+                                            capacity * sizeof(WuTopic*));
+    if (!topics) {
+      return NULL;
+    }
+
+    wu->topics = topics;
+    wu->topicsCapacity = capacity;
+  }
+
+  WuTopic* topic = WuTopicCreate(&wu->allocator);
+  if (!topic) {
+    return NULL;
+  }
+
+  topic->index = wu->numTopics;
+  wu->topics[wu->numTopics++] = topic;
+  return topic;
+}
+
+void WuDestroyTopic(Wu* wu, WuTopic* topic) {
+  for (int32_t i = 0; i < topic->numMembers; i++) {
+    topic->members[i]->numTopics--;
+  }
+
+  WuTopic* last = wu->topics[--wu->numTopics];
+  wu->topics[topic->index] = last;
+  last->index = topic->index;
+  WuTopicDestroy(topic);
+}
+
+int32_t WuSubscribe(Wu* wu, WuTopic* topic, WuClient* client) {
+  (void)wu;
+  if (WuTopicFind(topic, client) >= 0) {
+    return 1;
+  }
+
+  if (!WuTopicAdd(topic, client)) {
+    return 0;
+  }
+
+  client->numTopics++;
+  return 1;
+}
+
+void WuUnsubscribe(Wu* wu, WuTopic* topic, WuClient* client) {
+  (void)wu;
+  client->numTopics -= WuTopicRemove(topic, client);
+}
+
+int32_t WuTopicGetMemberCount(const WuTopic* topic) {
+  return topic->numMembers;
+}
+
+static int32_t WuPublishData(Wu* wu, WuTopic* topic, const uint8_t* data,
+                             int32_t length, DataChanProtoIdentifier proto) {
+  iovec buffer;
+  buffer.iov_base = (void*)data;
+  buffer.iov_len = size_t(length);
+
+  WuPreparedData prepared;
+  if (!WuPrepareData(wu, &prepared, &buffer, 1, proto)) {
+    return 0;
+  }
+
+  int32_t sent = 0;
+  WuClient** members = topic->members;
+  for (int32_t i = 0; i < topic->numMembers; i++) {
+    sent += WuSendPrepared(wu, members[i], &prepared) == 0 ? 1 : 0;
+  }
+
+  return sent;
+}
+
+int32_t WuPublish(Wu* wu, WuTopic* topic, const uint8_t* data,
+                  int32_t length) {
+  return WuPublishData(wu, topic, data, length, DCProto_Binary);
+}
+
+int32_t WuPublishText(Wu* wu, WuTopic* topic, const char* text,
+                      int32_t length) {
+  return WuPublishData(wu, topic, (const uint8_t*)text, length,
+                       DCProto_String);
+}
+
+int32_t WuPublishLowPriority(Wu* wu, WuTopic* topic, const uint8_t* data,
+                             int32_t length) {
+  if (wu->overloadLevel >= WuOverload_DropLowPriority) {
+    wu->stats.overloadDroppedMessages += uint64_t(topic->numMembers);
+    return 0;
+  }
+
+  return WuPublish(wu, topic, data, length);
+}
+
+int32_t WuSendBinaryLowPriority(Wu* wu, WuClient* client, const uint8_t* data,
+                                int32_t length) {
+  if (wu->overloadLevel >= WuOverload_DropLowPriority) {
+    wu->stats.overloadDroppedMessages++;
+    return -1;
+  }
+
+  return WuSendBinary(wu, client, data, length);
+}
+
+static void WuRollShedInterval(Wu* wu) {
+  for (int32_t i = 0; i < wu->numClients; i++) {
+    WuClient* client = wu->clients[i];
+    uint64_t total = 0;
+    for (int32_t c = 0; c < WuCost_Count; c++) {
+      total += client->cycles[c];
+    }
+
+    client->shedCycles = total - client->shedMark;
+    client->shedMark = total;
+  }
+
+  wu->shedIntervalEnd = wu->time + kShedInterval;
+}
+
+// Disconnects the client that cost the most cycles during the last
+// kShedInterval, rather than since it joined, so that a long lived client
+// isn't shed for load it caused long ago. At most once per interval so that
+// the smoothed iteration time can catch up.
+static void WuShedClient(Wu* wu) {
+  if (wu->time < wu->nextShedAt) {
+    return;
+  }
+
+  WuClient* top = NULL;
+  for (int32_t i = 0; i < wu->numClients; i++) {
+    WuClient* client = wu->clients[i];
+    if (client->state != WuClient_WaitingRemoval &&
+        (!top || client->shedCycles > top->shedCycles)) {
+      top = client;
+    }
+  }
+
+  if (!top) {
+    return;
+  }
+
+  if (top->heapIndex >= 0) {
+    WuWakeClient(wu, top);
+  }
+
+  WuClientRecord(wu, top, WuRecord_Shed);
+  top->state = WuClient_WaitingRemoval;
+  wu->stats.overloadDisconnects++;
+  wu->nextShedAt = wu->time + kShedInterval;
+}
+
+void WuOverloadUpdate(Wu* wu, double busyTime) {
+  if (wu->overloadBudget <= 0.0) {
+    return;
+  }
+
+  if (wu->time >= wu->shedIntervalEnd) {
+    WuRollShedInterval(wu);
+  }
+
+  wu->iterationTime += (busyTime - wu->iterationTime) * kOverloadSmoothing;
+  const double load = wu->iterationTime / wu->overloadBudget;
+
+  int32_t level = WuOverload_None;
+  while (level < WuOverload_Count - 1 &&
+         load >= wu->overloadThresholds[level]) {
+    level++;
+  }
+
+  // Step down only once clearly below the current level's threshold.
+  if (level < wu->overloadLevel &&
+      load >= wu->overloadThresholds[wu->overloadLevel - 1] *
+                  kOverloadHysteresis) {
+    level = wu->overloadLevel;
+  }
+
+  wu->overloadLevel = WuOverloadLevel(level);
+
+  if (wu->overloadLevel == WuOverload_Disconnect) {
+    WuShedClient(wu);
+  }
+}
+
+WuOverloadLevel WuGetOverloadLevel(const Wu* wu) { return wu->overloadLevel; }
@@ -7,13 +7,20 @@ struct WuClient;
 struct WuPool;
 struct WuArena;
 struct WuQueue;
+struct WuRecorder;
+struct WuCommandQueue;
+struct WuTopic;
 struct ssl_ctx_st;
+struct iovec;
 
 enum WuEventType {
   WuEvent_BinaryData,
   WuEvent_ClientJoin,
   WuEvent_ClientLeave,
-  WuEvent_TextData
+  WuEvent_TextData,
+  // The client's buffered amount fell to half of WuConf::sendHighWatermark
+  // after a send was refused or crossed it.
+  WuEvent_ClientWritable
 };
 
 struct WuEvent {
@@ -23,13 +30,40 @@ struct WuEvent {
   int32_t length;
 };
 
+enum WuClientState {
+  WuClient_Dead,
+  WuClient_WaitingRemoval,
+  WuClient_WaitingBinding,
+  WuClient_DTLSHandshake,
+  WuClient_SCTPEstablished,
+  WuClient_DataChannelOpen,
+  WuClient_NumStates
+};
+
 enum WuSDPStatus {
   WuSDPStatus_Success,
   WuSDPStatus_InvalidSDP,
   WuSDPStatus_MaxClients,
-  WuSDPStatus_Error
+  WuSDPStatus_Error,
+  WuSDPStatus_Overloaded
+};
+
+// Work shed by the overload controller, each level also sheds the work of
+// the levels below it.
+enum WuOverloadLevel {
+  WuOverload_None,
+  WuOverload_PauseAdmissions,
+  WuOverload_DeferHeartbeats,
+  WuOverload_DropLowPriority,
+  WuOverload_Disconnect,
+  WuOverload_Count
 };
 
+// When the client pool is full, a client that hasn't completed its STUN
+// binding is removed to make room for a newer offer, without a
+// WuEvent_ClientLeave, and its memory is reused right away. client is only
+// safe to keep once its WuEvent_ClientJoin arrived, before that compare
+// WuClientGetId with the id read here.
 struct SDPResult {
   WuSDPStatus status;
   WuClient* client;
@@ -37,37 +71,208 @@ struct SDPResult {
   int32_t sdpLength;
 };
 
+enum WuRecordType {
+  WuRecord_ClientCreated,
+  WuRecord_StunBinding,         // value: remote port
+  WuRecord_DtlsHandshakeStart,
+  WuRecord_DtlsHandshakeDone,
+  WuRecord_DtlsError,           // value: SSL_get_error result
+  WuRecord_SctpChunkIn,         // subtype: chunk type, value: TSN of DATA
+  WuRecord_SctpChunkOut,        // subtype: chunk type, value: TSN of DATA
+  WuRecord_HeartbeatRtt,        // value: microseconds
+  WuRecord_DataChannelOpen,
+  WuRecord_Hibernate,
+  WuRecord_Wake,
+  WuRecord_Expired,
+  WuRecord_Leave,
+  WuRecord_DtlsRetransmit,
+  WuRecord_Shed
+};
+
+struct WuRecord {
+  uint32_t time;  // Milliseconds since WuInit
+  uint32_t clientId;
+  uint8_t type;
+  uint8_t subtype;
+  uint16_t length;
+  uint32_t value;
+};
+
 typedef void (*WuErrorFn)(const char* err, void* userData);
 typedef void (*WuWriteFn)(const uint8_t* data, size_t length,
                           const WuClient* client, void* userData);
 
+typedef void (*WuRecordFn)(const WuRecord* record, void* userData);
+
+typedef void* (*WuAllocateFn)(size_t size, void* userData);
+typedef void* (*WuReallocateFn)(void* ptr, size_t size, void* userData);
+typedef void (*WuDeallocateFn)(void* ptr, void* userData);
+
+struct WuAllocator {
+  WuAllocateFn allocate = nullptr;
+  WuReallocateFn reallocate = nullptr;
+  WuDeallocateFn deallocate = nullptr;
+  void* userData = nullptr;
+};
+
 struct WuAddress {
   uint32_t host;
   uint16_t port;
 };
 
+const int32_t kWuHistogramBuckets = 16;
+
+// Latency histogram in seconds. The last bucket counts values above the
+// largest bound.
+struct WuHistogram {
+  uint64_t buckets[kWuHistogramBuckets + 1];
+  uint64_t count;
+  double sum;
+};
+
+enum WuCostType { WuCost_Stun, WuCost_Dtls, WuCost_Sctp, WuCost_Count };
+
+// Time spent handling a client's datagrams in CycleCounter units, see
+// WuGetCostUnit.
+struct WuClientCost {
+  WuClient* client;
+  uint64_t total;
+  uint64_t cycles[WuCost_Count];
+};
+
+// From the client's answers to time sync packets, see WuTimeSync.h. offset
+// is the client clock minus the server's monotonic clock in seconds.
+struct WuTimeSync {
+  double offset;
+  double rtt;
+  uint32_t samples;
+};
+
+struct WuStats {
+  uint64_t datagramsIn;
+  uint64_t bytesIn;
+  uint64_t datagramsOut;
+  uint64_t bytesOut;
+  uint64_t handshakes;
+  uint64_t dtlsRetransmits;
+  uint64_t duplicateTsns;
+  uint64_t dataChunksIn;
+  uint64_t controlPacketsOut;
+  uint64_t forwardTsnsIn;
+  uint64_t forwardTsnsOut;
+  uint64_t droppedCommands;
+  uint64_t overloadRefusedOffers;
+  uint64_t overloadDeferredHeartbeats;
+  uint64_t overloadDroppedMessages;
+  uint64_t overloadDisconnects;
+  uint64_t unclassifiedDatagrams;
+  uint64_t queuedHandshakeDatagrams;
+  uint64_t droppedHandshakeDatagrams;
+  uint64_t droppedEvents;
+  uint64_t handshakeBudgetHits;
+  uint64_t timeSyncPackets;
+  uint64_t unattributedCycles;
+  WuHistogram joinLatency;
+};
+
+// Bytes held by each subsystem. ssl is -1 unless OpenSSL allocations are
+// routed through WuConf::installSslAllocator. connectionBuffers is filled in
+// by the host.
+struct WuMemoryStats {
+  size_t clientPool;
+  size_t clientIndex;
+  size_t clientStructs;
+  size_t arena;
+  size_t arenaPeak;
+  size_t eventQueue;
+  size_t handshakeQueue;
+  size_t recorder;
+  size_t commandQueue;
+  size_t topics;
+  size_t connectionBuffers;
+  int64_t ssl;
+  size_t total;
+};
+
 struct WuConf {
   const char* host = "127.0.0.1";
   const char* port = "9555";
   int maxClients = 256;
+  int clientChunkSize = 64;
+  double hibernateTimeout = 2.0;
+  double bindingTimeout = 2.0;
+  int sendHighWatermark = 65536;
+  WuAllocator allocator;
+  bool installSslAllocator = false;
+  int recorderSize = 4096;
+  double dtlsRetransmitTimeout = 0.25;
+  int udpRecvBufferSize = 0;
+  int udpSendBufferSize = 0;
+  const char* captureFile = nullptr;
+  const char* keyLogFile = nullptr;
+  // Bytes for commands enqueued from other threads, 0 disables the queue.
+  int commandQueueSize = 0;
+  // Seconds of work per host loop iteration, 0 disables the overload
+  // controller. Each level past WuOverload_None starts when the smoothed
+  // iteration time reaches its multiple of the budget in overloadThresholds.
+  double overloadBudget = 0.0;
+  double overloadThresholds[WuOverload_Count - 1] = {1.0, 1.5, 2.0, 3.0};
+  // DTLS datagrams of clients still in their handshake wait in a queue of up
+  // to handshakeQueueSize datagrams, serviced after established clients for
+  // at most handshakeBudget seconds per tick. 0 removes the time limit.
+  double handshakeBudget = 0.005;
+  int handshakeQueueSize = 1024;
+  // Answer time sync packets (32 byte binary messages starting with "WuTS")
+  // inline instead of delivering them as WuEvent_BinaryData.
+  bool timeSync = false;
 };
 
 struct Wu {
+  WuAllocator allocator;
   WuArena* arena;
   double time;
   double dt;
   char host[256];
   uint16_t port;
   WuQueue* pendingEvents;
+  WuQueue* handshakeQueue;
+  double handshakeBudget;
+  int32_t maxQueuedHandshakes;
   int32_t maxClients;
   int32_t numClients;
+  int32_t numActiveClients;
+  int32_t numHibernatedClients;
+  int32_t clientsCapacity;
+  double hibernateTimeout;
+  double dtlsRetransmitTimeout;
+  double bindingTimeout;
+  int32_t sendHighWatermark;
+  bool timeSync;
 
   WuPool* clientPool;
   WuClient** clients;
+  WuClient** hibernatedClients;
   ssl_ctx_st* sslCtx;
 
   char certFingerprint[96];
 
+  WuStats stats;
+  WuRecorder* recorder;
+  WuCommandQueue* commands;
+  WuTopic** topics;
+  int32_t numTopics;
+  int32_t topicsCapacity;
+
+  double overloadBudget;
+  double overloadThresholds[WuOverload_Count - 1];
+  double iterationTime;
+  double nextShedAt;
+  double shedIntervalEnd;
+  WuOverloadLevel overloadLevel;
+  WuRecordFn leaveRecordsFn;
+  void* leaveRecordsUserData;
+  uint32_t nextClientId;
+
   char errBuf[512];
   void* userData;
   WuErrorFn errorCallback;
@@ -75,11 +280,17 @@ struct Wu {
 };
 
 int32_t WuInit(Wu* wu, const WuConf* conf);
+// WuConf::maxClients as WuInit applies it, with the default for values <= 0.
+int32_t WuConfMaxClients(const WuConf* conf);
 int32_t WuUpdate(Wu* wu, WuEvent* evt);
 void WuReportError(Wu* wu, const char* error);
 int32_t WuSendText(Wu* wu, WuClient* client, const char* text, int32_t length);
 int32_t WuSendBinary(Wu* wu, WuClient* client, const uint8_t* data,
                      int32_t length);
+// Sends the concatenation of the buffers as one message, gathered straight
+// into the SCTP packet.
+int32_t WuSendBinaryV(Wu* wu, WuClient* client, const iovec* buffers,
+                      int32_t count);
 void WuRemoveClient(Wu* wu, WuClient* client);
 void WuClientSetUserData(WuClient* client, void* user);
 void* WuClientGetUserData(const WuClient* client);
@@ -90,3 +301,56 @@ void WuSetUDPWriteFunction(Wu* wu, WuWriteFn write);
 void WuSetUserData(Wu* wu, void* userData);
 void WuSetErrorCallback(Wu* wu, WuErrorFn callback);
 WuAddress WuClientGetAddress(const WuClient* client);
+int32_t WuClientIsHibernated(const WuClient* client);
+WuClientState WuClientGetState(const WuClient* client);
+// Bytes sent to the client that it hasn't acknowledged yet.
+int32_t WuClientGetBufferedAmount(const WuClient* client);
+uint32_t WuClientGetId(const WuClient* client);
+// Returns 0 until the client completed a time sync exchange.
+int32_t WuClientGetTimeSync(const WuClient* client, WuTimeSync* sync);
+void WuClientGetCost(const WuClient* client, WuClientCost* cost);
+int32_t WuTopClientsByCost(const Wu* wu, WuClientCost* top, int32_t n);
+void WuResetClientCosts(Wu* wu);
+// "TSC cycles" on x86, "generic timer ticks" on aarch64, "nanoseconds"
+// elsewhere.
+const char* WuGetCostUnit();
+void WuGetMemoryStats(const Wu* wu, WuMemoryStats* stats);
+int32_t WuDumpRecords(const Wu* wu, uint32_t clientId, WuRecordFn fn,
+                      void* userData);
+void WuSetLeaveRecordsCallback(Wu* wu, WuRecordFn fn, void* userData);
+
+// Safe to call from any thread. The commands run on the thread calling
+// WuUpdate at the start of its next tick, and are dropped if the client with
+// clientId left in the meantime. Return 0 when the queue is full or
+// WuConf::commandQueueSize is 0.
+int32_t WuEnqueueSendText(Wu* wu, WuClient* client, uint32_t clientId,
+                          const char* text, int32_t length);
+int32_t WuEnqueueSendBinary(Wu* wu, WuClient* client, uint32_t clientId,
+                            const uint8_t* data, int32_t length);
+int32_t WuEnqueueRemoveClient(Wu* wu, WuClient* client, uint32_t clientId);
+const char* WuRecordTypeName(uint8_t type);
+
+// Groups of clients to send the same message to. Clients are unsubscribed
+// from every topic when they're removed.
+WuTopic* WuCreateTopic(Wu* wu);
+void WuDestroyTopic(Wu* wu, WuTopic* topic);
+int32_t WuSubscribe(Wu* wu, WuTopic* topic, WuClient* client);
+void WuUnsubscribe(Wu* wu, WuTopic* topic, WuClient* client);
+int32_t WuTopicGetMemberCount(const WuTopic* topic);
+// Sends the message to every member of the topic. The SCTP packet is
+// serialized once and only patched per member. Returns the number of members
+// it was sent to.
+int32_t WuPublish(Wu* wu, WuTopic* topic, const uint8_t* data, int32_t length);
+int32_t WuPublishText(Wu* wu, WuTopic* topic, const char* text,
+                      int32_t length);
+
+// Feeds the time one iteration of the host loop spent working, waits
+// excluded, to the overload controller. WuHostServe calls it.
+void WuOverloadUpdate(Wu* wu, double busyTime);
+WuOverloadLevel WuGetOverloadLevel(const Wu* wu);
+// Dropped from WuOverload_DropLowPriority on, otherwise like WuSendBinary and
+// WuPublish.
+int32_t WuSendBinaryLowPriority(Wu* wu, WuClient* client, const uint8_t* data,
+                                int32_t length);
+int32_t WuPublishLowPriority(Wu* wu, WuTopic* topic, const uint8_t* data,
+                             int32_t length);
@@ -0,0 +1,152 @@
+#include "WuAlloc.h"
+#include <openssl/crypto.h>
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+#include "Wu.h"
+
+static bool Custom(const WuAllocator* allocator) {
+  return allocator && allocator->allocate;
+}
+
+void* WuAlloc(const WuAllocator* allocator, size_t size) {
+  if (Custom(allocator)) {
+    return allocator->allocate(size, allocator->userData);
+  }
+
+  return malloc(size);
+}
+
+void* WuCalloc(const WuAllocator* allocator, size_t count, size_t size) {
+  if (Custom(allocator)) {
+    size_t total = count * size;
+    if (size != 0 && total / size != count) {
+      return NULL;
+    }
+
+    void* ptr = allocator->allocate(total, allocator->userData);
+    if (ptr) {
+      memset(ptr, 0, total);
+    }
+    return ptr;
+  }
+
+  return calloc(count, size);
+}
+
+void* WuRealloc(const WuAllocator* allocator, void* ptr, size_t size) {
+  if (Custom(allocator)) {
+    return allocator->reallocate(ptr, size, allocator->userData);
+  }
+
+  return realloc(ptr, size);
+}
+
+void WuFree(const WuAllocator* allocator, void* ptr) {
+  if (Custom(allocator)) {
+    allocator->deallocate(ptr, allocator->userData);
+    return;
+  }
+
+  free(ptr);
+}
+
+bool WuAllocatorValid(const WuAllocator* allocator) {
+  const bool any =
+      allocator->allocate || allocator->reallocate || allocator->deallocate;
+  const bool all =
+      allocator->allocate && allocator->reallocate && allocator->deallocate;
+  return any == all;
+}
+
+// OpenSSL's memory functions are process wide and carry no user pointer.
+// Every block is prefixed with its size so that the bytes held by OpenSSL
+// can be reported, OpenSSL may allocate from other threads.
+static WuAllocator sslAllocator;
+static std::atomic<int64_t> sslBytes(-1);
+const size_t kSslHeaderSize = 16;
+
+static void* SslAllocBlock(size_t size) {
+  uint8_t* block = (uint8_t*)WuAlloc(&sslAllocator, size + kSslHeaderSize);
+  if (!block) {
+    return NULL;
+  }
+
+  memcpy(block, &size, sizeof(size));
+  sslBytes.fetch_add(size, std::memory_order_relaxed);
+  return block + kSslHeaderSize;
+}
+
+static void* SslReallocBlock(void* ptr, size_t size) {
+  if (!ptr) {
+    return SslAllocBlock(size);
+  }
+
+  uint8_t* block = (uint8_t*)ptr - kSslHeaderSize;
+  size_t oldSize;
+  memcpy(&oldSize, block, sizeof(oldSize));
+
+  block = (uint8_t*)WuRealloc(&sslAllocator, block, size + kSslHeaderSize);
+  if (!block) {
+    return NULL;
+  }
+
+  memcpy(block, &size, sizeof(size));
+  sslBytes.fetch_add(int64_t(size) - int64_t(oldSize),
+                     std::memory_order_relaxed);
+  return block + kSslHeaderSize;
+}
+
+static void SslFreeBlock(void* ptr) {
+  if (!ptr) {
+    return;
+  }
+
+  uint8_t* block = (uint8_t*)ptr - kSslHeaderSize;
+  size_t size;
+  memcpy(&size, block, sizeof(size));
+  sslBytes.fetch_sub(size, std::memory_order_relaxed);
+  WuFree(&sslAllocator, block);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static void* SslAlloc(size_t size, const char*, int) {
+  return SslAllocBlock(size);
+}
+
+static void* SslRealloc(void* ptr, size_t size, const char*, int) {
+  return SslReallocBlock(ptr, size);
+}
+
+static void SslFree(void* ptr, const char*, int) { SslFreeBlock(ptr); }
+#else
+static void* SslAlloc(size_t size) { return SslAllocBlock(size); }
+
+static void* SslRealloc(void* ptr, size_t size) {
+  return SslReallocBlock(ptr, size);
+}
+
+static void SslFree(void* ptr) { SslFreeBlock(ptr); }
+#endif
+
+int64_t WuSslAllocatedBytes() {
+  return sslBytes.load(std::memory_order_relaxed);
+}
+
+bool WuInstallSslAllocator(const WuAllocator* allocator) {
+  static bool installed = false;
+
+  if (installed) {
+    return memcmp(&sslAllocator, allocator, sizeof(WuAllocator)) == 0;
+  }
+
+  sslAllocator = *allocator;
+  if (!CRYPTO_set_mem_functions(SslAlloc, SslRealloc, SslFree)) {
+    sslAllocator = WuAllocator();
+    return false;
+  }
+
+  sslBytes.store(0, std::memory_order_relaxed);
+  installed = true;
+  return true;
+}
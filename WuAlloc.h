@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct WuAllocator;
+
+void* WuAlloc(const WuAllocator* allocator, size_t size);
+void* WuCalloc(const WuAllocator* allocator, size_t count, size_t size);
+void* WuRealloc(const WuAllocator* allocator, void* ptr, size_t size);
+void WuFree(const WuAllocator* allocator, void* ptr);
+bool WuAllocatorValid(const WuAllocator* allocator);
+bool WuInstallSslAllocator(const WuAllocator* allocator);
+
+// Bytes currently held by OpenSSL, -1 unless WuInstallSslAllocator succeeded.
+int64_t WuSslAllocatedBytes();
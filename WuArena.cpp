@@ -1,11 +1,16 @@
 #include "WuArena.h"
 #include <assert.h>
-#include <stdlib.h>
+#include "WuAlloc.h"
+#include "WuMath.h"
+#include "WuTrace.h"
 
-void WuArenaInit(WuArena* arena, int32_t capacity) {
-  arena->memory = (uint8_t*)calloc(capacity, 1);
+void WuArenaInit(WuArena* arena, const WuAllocator* allocator,
+                 int32_t capacity) {
+  arena->allocator = *allocator;
+  arena->memory = (uint8_t*)WuCalloc(allocator, capacity, 1);
   arena->length = 0;
   arena->capacity = capacity;
+  arena->highWater = 0;
 }
 
 void* WuArenaAcquire(WuArena* arena, int32_t blockSize) {
@@ -15,12 +20,16 @@ void* WuArenaAcquire(WuArena* arena, int32_t blockSize) {
   if (remain >= blockSize) {
     uint8_t* m = arena->memory + arena->length;
     arena->length += blockSize;
+    arena->highWater = Max(arena->highWater, arena->length);
     return m;
   }
 
+  WU_TRACE3(arena_exhausted, arena, arena->capacity, blockSize);
   return NULL;
 }
 
 void WuArenaReset(WuArena* arena) { arena->length = 0; }
 
-void WuArenaDestroy(WuArena* arena) { free(arena->memory); }
+void WuArenaDestroy(WuArena* arena) {
+  WuFree(&arena->allocator, arena->memory);
+}
@@ -1,14 +1,18 @@
 #pragma once
 
 #include <stdint.h>
+#include "Wu.h"
 
 struct WuArena {
+  WuAllocator allocator;
   uint8_t* memory;
   int32_t length;
   int32_t capacity;
+  int32_t highWater;
 };
 
-void WuArenaInit(WuArena* arena, int32_t capacity);
+void WuArenaInit(WuArena* arena, const WuAllocator* allocator,
+                 int32_t capacity);
 void* WuArenaAcquire(WuArena* arena, int32_t blockSize);
 void WuArenaReset(WuArena* arena);
 void WuArenaDestroy(WuArena* arena);
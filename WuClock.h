@@ -2,19 +2,36 @@
 #ifdef _WIN32
 #include <windows.h>
 #else
-#include <sys/time.h>
+#include <time.h>
 #endif
 #include <stdint.h>
 
+// CycleCounter reads the TSC on x86, the generic timer on aarch64 and falls
+// back to the monotonic clock in nanoseconds elsewhere. WU_CYCLE_UNIT names
+// the unit of its values for metrics and the cost API.
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+    defined(_M_IX86)
+#ifdef _WIN32
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define WU_CYCLE_UNIT "TSC cycles"
+#elif defined(__aarch64__)
+#define WU_CYCLE_UNIT "generic timer ticks"
+#else
+#define WU_CYCLE_UNIT "nanoseconds"
+#endif
+
 inline int64_t HpCounter() {
 #ifdef _WIN32
   LARGE_INTEGER li;
   QueryPerformanceCounter(&li);
   int64_t i64 = li.QuadPart;
 #else
-  struct timeval t;
-  gettimeofday(&t, 0);
-  int64_t i64 = t.tv_sec * int64_t(1000000) + t.tv_usec;
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  int64_t i64 = t.tv_sec * int64_t(1000000) + t.tv_nsec / 1000;
 #endif
   return i64;
 }
@@ -32,3 +49,20 @@ inline int64_t HpFreq() {
 inline double MsNow() {
   return double(HpCounter()) * 1000.0 / double(HpFreq());
 }
+
+inline uint64_t CycleCounter() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+    defined(_M_IX86)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t ticks;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
+#elif defined(_WIN32)
+  return uint64_t(HpCounter());
+#else
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return uint64_t(t.tv_sec) * 1000000000u + uint64_t(t.tv_nsec);
+#endif
+}
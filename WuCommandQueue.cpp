@@ -0,0 +1,130 @@
+#include "WuCommandQueue.h"
+#include <string.h>
+#include "WuAlloc.h"
+
+const uint32_t kMinCommandQueueSize = 4096;
+
+static uint32_t CommandSize(int32_t length) {
+  return (uint32_t(sizeof(WuCommand)) + uint32_t(length) + 7) & ~7u;
+}
+
+static WuCommand* CommandAt(WuCommandQueue* q, uint64_t position) {
+  return (WuCommand*)(q->buffer + (position & (q->capacity - 1)));
+}
+
+WuCommandQueue* WuCommandQueueCreate(const WuAllocator* allocator,
+                                     int32_t capacity) {
+  uint32_t size = kMinCommandQueueSize;
+  while (size < uint32_t(capacity)) {
+    size <<= 1;
+  }
+
+  WuCommandQueue* q =
+      (WuCommandQueue*)WuCalloc(allocator, 1, sizeof(WuCommandQueue));
+  if (!q) {
+    return NULL;
+  }
+
+  // Zeroed, every size word reads as not yet published.
+  q->buffer = (uint8_t*)WuCalloc(allocator, size, 1);
+  if (!q->buffer) {
+    WuFree(allocator, q);
+    return NULL;
+  }
+
+  q->allocator = *allocator;
+  q->capacity = size;
+  q->head.store(0, std::memory_order_relaxed);
+  q->tail.store(0, std::memory_order_relaxed);
+  return q;
+}
+
+void WuCommandQueueDestroy(WuCommandQueue* q) {
+  const WuAllocator allocator = q->allocator;
+  WuFree(&allocator, q->buffer);
+  WuFree(&allocator, q);
+}
+
+int32_t WuCommandQueuePush(WuCommandQueue* q, WuCommandType type,
+                           WuClient* client, uint32_t clientId,
+                           const uint8_t* data, int32_t length) {
+  const uint32_t size = CommandSize(length);
+  if (length < 0 || size > q->capacity / 2) {
+    return 0;
+  }
+
+  // Commands don't wrap around the end of the buffer, the remainder is
+  // claimed as padding and the command starts at offset 0.
+  uint64_t head = q->head.load(std::memory_order_relaxed);
+  uint32_t padding;
+  for (;;) {
+    const uint32_t offset = uint32_t(head & (q->capacity - 1));
+    padding = offset + size > q->capacity ? q->capacity - offset : 0;
+
+    const uint64_t tail = q->tail.load(std::memory_order_acquire);
+    if (head + padding + size - tail > q->capacity) {
+      return 0;
+    }
+
+    if (q->head.compare_exchange_weak(head, head + padding + size,
+                                      std::memory_order_relaxed)) {
+      break;
+    }
+  }
+
+  if (padding) {
+    // Only the first 8 bytes of a padding record are touched, the remainder
+    // may be shorter than a full header.
+    WuCommand* pad = CommandAt(q, head);
+    pad->type = WuCommand_Padding;
+    pad->size.store(padding, std::memory_order_release);
+  }
+
+  WuCommand* command = CommandAt(q, head + padding);
+  command->type = uint8_t(type);
+  command->clientId = clientId;
+  command->length = length;
+  command->client = client;
+  if (length > 0) {
+    memcpy((uint8_t*)(command + 1), data, length);
+  }
+  command->size.store(size, std::memory_order_release);
+
+  return 1;
+}
+
+int32_t WuCommandQueueDrain(WuCommandQueue* q, WuCommandFn fn,
+                            void* userData) {
+  uint64_t tail = q->tail.load(std::memory_order_relaxed);
+  const uint64_t head = q->head.load(std::memory_order_acquire);
+
+  // Stops at the first command still being written, or at the head seen on
+  // entry so that busy producers can't keep the consumer here.
+  int32_t count = 0;
+  while (tail != head) {
+    WuCommand* command = CommandAt(q, tail);
+    const uint32_t size = command->size.load(std::memory_order_acquire);
+    if (size == 0) {
+      break;
+    }
+
+    // Producers only write the header and the payload, everything else in
+    // the buffer is still zero. A padding record has only size and type.
+    if (command->type != WuCommand_Padding) {
+      fn(command, (const uint8_t*)(command + 1), userData);
+      count++;
+
+      memset((uint8_t*)(command + 1), 0, size_t(command->length));
+      command->clientId = 0;
+      command->length = 0;
+      command->client = NULL;
+    }
+
+    command->type = 0;
+    command->size.store(0, std::memory_order_relaxed);
+    tail += size;
+  }
+
+  q->tail.store(tail, std::memory_order_release);
+  return count;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include "Wu.h"
+
+enum WuCommandType {
+  WuCommand_Padding,
+  WuCommand_SendText,
+  WuCommand_SendBinary,
+  WuCommand_RemoveClient
+};
+
+// Header of a command in the ring, followed by its payload. size stays 0
+// until the producer has written the rest, then it's published last.
+struct WuCommand {
+  std::atomic<uint32_t> size;
+  uint8_t type;
+  uint8_t reserved[3];
+  uint32_t clientId;
+  int32_t length;
+  WuClient* client;
+};
+
+// Ring of variable size commands, filled from any thread and drained by the
+// thread running Wu. Producers claim space with a CAS on head, the consumer
+// hands it back by advancing tail. Positions only grow, offsets into the
+// buffer are position & (capacity - 1).
+struct WuCommandQueue {
+  WuAllocator allocator;
+  uint8_t* buffer;
+  uint32_t capacity;
+  uint8_t pad0[64];
+  std::atomic<uint64_t> head;
+  uint8_t pad1[64];
+  std::atomic<uint64_t> tail;
+  uint8_t pad2[64];
+};
+
+typedef void (*WuCommandFn)(const WuCommand* command, const uint8_t* data,
+                            void* userData);
+
+WuCommandQueue* WuCommandQueueCreate(const WuAllocator* allocator,
+                                     int32_t capacity);
+void WuCommandQueueDestroy(WuCommandQueue* q);
+int32_t WuCommandQueuePush(WuCommandQueue* q, WuCommandType type,
+                           WuClient* client, uint32_t clientId,
+                           const uint8_t* data, int32_t length);
+int32_t WuCommandQueueDrain(WuCommandQueue* q, WuCommandFn fn,
+                            void* userData);
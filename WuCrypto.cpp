@@ -22,7 +22,7 @@ WuCert::WuCert() : key(EVP_PKEY_new()), x509(X509_new()) {
     RAND_seed(&seed, sizeof(seed));
   }
 
-  RSA_generate_key_ex(rsa, 1024, n, NULL);
+  RSA_generate_key_ex(rsa, 2048, n, NULL);
   EVP_PKEY_assign_RSA(key, rsa);
 
   BIGNUM* serial = BN_new();
@@ -37,7 +37,7 @@ WuCert::WuCert() : key(EVP_PKEY_new()), x509(X509_new()) {
   X509_set_issuer_name(x509, name);
   X509_gmtime_adj(X509_get_notBefore(x509), 0);
   X509_gmtime_adj(X509_get_notAfter(x509), 365 * 24 * 3600);
-  X509_sign(x509, key, EVP_sha1());
+  X509_sign(x509, key, EVP_sha256());
 
   unsigned int len = 32;
   uint8_t buf[32] = {0};
@@ -4,6 +4,14 @@
 
 struct WuHost;
 
+struct WuHostSocketStats {
+  uint64_t kernelDrops;
+  uint64_t sendBufferFull;
+  uint64_t sendErrors;
+  int32_t recvBufferSize;
+  int32_t sendBufferSize;
+};
+
 WuHost* WuHostCreate(const WuConf* conf);
 int32_t WuHostServe(WuHost* host, WuEvent* evt);
 void WuHostRemoveClient(WuHost* wu, WuClient* client);
@@ -11,4 +19,31 @@ int32_t WuHostSendText(WuHost* host, WuClient* client, const char* text,
                        int32_t length);
 int32_t WuHostSendBinary(WuHost* host, WuClient* client, const uint8_t* data,
                          int32_t length);
+int32_t WuHostSendBinaryV(WuHost* host, WuClient* client, const iovec* buffers,
+                          int32_t count);
+int32_t WuHostEnqueueSendText(WuHost* host, WuClient* client,
+                              uint32_t clientId, const char* text,
+                              int32_t length);
+int32_t WuHostEnqueueSendBinary(WuHost* host, WuClient* client,
+                                uint32_t clientId, const uint8_t* data,
+                                int32_t length);
+int32_t WuHostEnqueueRemoveClient(WuHost* host, WuClient* client,
+                                  uint32_t clientId);
+WuTopic* WuHostCreateTopic(WuHost* host);
+void WuHostDestroyTopic(WuHost* host, WuTopic* topic);
+int32_t WuHostSubscribe(WuHost* host, WuTopic* topic, WuClient* client);
+void WuHostUnsubscribe(WuHost* host, WuTopic* topic, WuClient* client);
+int32_t WuHostPublish(WuHost* host, WuTopic* topic, const uint8_t* data,
+                      int32_t length);
+int32_t WuHostPublishText(WuHost* host, WuTopic* topic, const char* text,
+                          int32_t length);
+WuOverloadLevel WuHostGetOverloadLevel(WuHost* host);
 void WuHostSetErrorCallback(WuHost* host, WuErrorFn callback);
+int32_t WuHostDumpRecords(WuHost* host, uint32_t clientId, WuRecordFn fn,
+                          void* userData);
+void WuHostSetLeaveRecordsCallback(WuHost* host, WuRecordFn fn,
+                                   void* userData);
+int32_t WuHostTopClientsByCost(WuHost* host, WuClientCost* top, int32_t n);
+void WuHostResetClientCosts(WuHost* host);
+void WuHostGetMemoryStats(WuHost* host, WuMemoryStats* stats);
+void WuHostGetSocketStats(WuHost* host, WuHostSocketStats* stats);
@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 #include <netinet/tcp.h>
 #include <stdio.h>
@@ -8,24 +9,35 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <new>
+#include "WuAlloc.h"
+#include "WuClock.h"
 #include "WuHost.h"
 #include "WuHttp.h"
 #include "WuMath.h"
+#include "WuMetrics.h"
 #include "WuNetwork.h"
+#include "WuPcap.h"
 #include "WuPool.h"
 #include "WuRng.h"
 #include "WuString.h"
 #include "picohttpparser.h"
 
+// Datagrams read per WuHostServe call, the rest are picked up by the next one
+// so that a flood on the UDP socket can't starve the TCP listener and ticks.
+const int32_t kMaxDatagramsPerServe = 1024;
+const int32_t kMaxMetricsLength = 16384;
+
 struct WuConnectionBuffer {
   size_t size = 0;
   int fd = -1;
+  WuAddress remote;
   uint8_t requestBuffer[kMaxHttpRequestLength];
 };
 
 struct WuConnectionBufferPool {
-  WuConnectionBufferPool(size_t n)
-      : pool(WuPoolCreate(sizeof(WuConnectionBuffer), n)) {}
+  WuConnectionBufferPool(const WuAllocator* allocator, size_t n)
+      : pool(WuPoolCreate(allocator, sizeof(WuConnectionBuffer), n, n)) {}
 
   WuConnectionBuffer* GetBuffer() {
     WuConnectionBuffer* buffer = (WuConnectionBuffer*)WuPoolAcquire(pool);
@@ -52,6 +64,18 @@ struct WuHost {
   int32_t maxEvents;
   struct epoll_event* events;
   Wu* wu;
+
+  FILE* capture;
+  WuAddress local;
+
+  bool udpPending;
+  uint64_t recvBudgetHits;
+  WuHostSocketStats socketStats;
+  WuHistogram serveTime;
+  double handshakeRate;
+  double rateWindowStart;
+  uint64_t rateWindowHandshakes;
+  char metrics[kMaxMetricsLength];
 };
 
 static void HandleErrno(WuHost* host, const char* description) {
@@ -70,8 +94,86 @@ static void WriteUDPData(const uint8_t* data, size_t length,
   netaddr.sin_port = htons(address.port);
   netaddr.sin_addr.s_addr = htonl(address.host);
 
-  sendto(host->udpfd, data, length, 0, (struct sockaddr*)&netaddr,
-         sizeof(netaddr));
+  ssize_t r = sendto(host->udpfd, data, length, 0,
+                     (struct sockaddr*)&netaddr, sizeof(netaddr));
+  if (r == -1) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+      host->socketStats.sendBufferFull++;
+    } else {
+      host->socketStats.sendErrors++;
+    }
+  }
+}
+
+static void WriteMemoryMetrics(WuHost* host, WuMetricsWriter* w) {
+  WuMemoryStats memory;
+  WuHostGetMemoryStats(host, &memory);
+
+  WuMetricsAppend(w,
+                  "# HELP wu_memory_bytes Bytes held by subsystem.\n"
+                  "# TYPE wu_memory_bytes gauge\n"
+                  "wu_memory_bytes{subsystem=\"client_pool\"} %zu\n"
+                  "wu_memory_bytes{subsystem=\"client_index\"} %zu\n"
+                  "wu_memory_bytes{subsystem=\"arena\"} %zu\n"
+                  "wu_memory_bytes{subsystem=\"event_queue\"} %zu\n"
+                  "wu_memory_bytes{subsystem=\"recorder\"} %zu\n"
+                  "wu_memory_bytes{subsystem=\"connection_buffers\"} %zu\n",
+                  memory.clientPool, memory.clientIndex, memory.arena,
+                  memory.eventQueue, memory.recorder,
+                  memory.connectionBuffers);
+
+  if (memory.ssl >= 0) {
+    WuMetricsAppend(w, "wu_memory_bytes{subsystem=\"ssl\"} %lld\n",
+                    (long long)memory.ssl);
+  }
+
+  WuMetricsGauge(w, "wu_memory_total_bytes", "Bytes held by Wu and the host.",
+                 double(memory.total));
+}
+
+static void WriteMetrics(WuHost* host, int fd) {
+  WuMetricsWriter w;
+  WuMetricsInit(&w, host->metrics, sizeof(host->metrics));
+  WuMetricsWriteCore(&w, host->wu);
+  WuMetricsGauge(&w, "wu_handshakes_per_second",
+                 "DTLS handshakes completed per second.", host->handshakeRate);
+  WuMetricsCounter(&w, "wu_recv_budget_hits_total",
+                   "Serve calls that left datagrams in the UDP socket.",
+                   host->recvBudgetHits);
+  WuHostSocketStats socketStats;
+  WuHostGetSocketStats(host, &socketStats);
+  WuMetricsCounter(&w, "wu_udp_kernel_drops_total",
+                   "Datagrams dropped by the kernel, receive buffer full.",
+                   socketStats.kernelDrops);
+  WuMetricsCounter(&w, "wu_udp_send_buffer_full_total",
+                   "Datagrams not sent, send buffer full.",
+                   socketStats.sendBufferFull);
+  WuMetricsCounter(&w, "wu_udp_send_errors_total",
+                   "Datagrams not sent for other reasons.",
+                   socketStats.sendErrors);
+  WuMetricsGauge(&w, "wu_udp_recv_buffer_bytes", "SO_RCVBUF of the socket.",
+                 socketStats.recvBufferSize);
+  WuMetricsGauge(&w, "wu_udp_send_buffer_bytes", "SO_SNDBUF of the socket.",
+                 socketStats.sendBufferSize);
+  WuMetricsHistogram(&w, "wu_serve_duration_seconds",
+                     "Busy time of a poll iteration.", &host->serveTime);
+  WriteMemoryMetrics(host, &w);
+
+  if (w.truncated) {
+    SocketWrite(fd, STRLIT(HTTP_SERVER_ERROR));
+    return;
+  }
+
+  char header[256];
+  int headerLength = snprintf(header, sizeof(header),
+                              "HTTP/1.1 200 OK\r\n"
+                              "Content-Type: text/plain; version=0.0.4\r\n"
+                              "Content-Length: %d\r\n"
+                              "Connection: close\r\n"
+                              "\r\n",
+                              w.length);
+  SocketWrite(fd, header, headerLength);
+  SocketWrite(fd, w.buf, w.length);
 }
 
 static void HandleHttpRequest(WuHost* host, WuConnectionBuffer* conn) {
@@ -105,6 +207,14 @@ static void HandleHttpRequest(WuHost* host, WuConnectionBuffer* conn) {
         &path, &pathLength, &minorVersion, headers, &numHeaders, prevSize);
 
     if (parseStatus > 0) {
+      if (MemEqual(method, methodLength, STRLIT("GET")) &&
+          MemEqual(path, pathLength, STRLIT("/metrics"))) {
+        WriteMetrics(host, conn->fd);
+        close(conn->fd);
+        host->bufferPool->Reclaim(conn);
+        return;
+      }
+
       size_t contentLength = 0;
       for (size_t i = 0; i < numHeaders; i++) {
         if (CompareCaseInsensitive(headers[i].name, headers[i].name_len,
@@ -116,6 +226,11 @@ static void HandleHttpRequest(WuHost* host, WuConnectionBuffer* conn) {
 
       if (contentLength > 0) {
         if (conn->size == parseStatus + contentLength) {
+          if (host->capture) {
+            WuPcapWrite(host->capture, WuPcap_Tcp, &conn->remote, &host->local,
+                        conn->requestBuffer + parseStatus, contentLength);
+          }
+
           const SDPResult sdp = WuExchangeSDP(
               host->wu, (const char*)conn->requestBuffer + parseStatus,
               contentLength);
@@ -132,7 +247,8 @@ static void HandleHttpRequest(WuHost* host, WuConnectionBuffer* conn) {
                          "\r\n%.*s",
                          sdp.sdpLength, sdp.sdpLength, sdp.sdp);
             SocketWrite(conn->fd, response, responseLength);
-          } else if (sdp.status == WuSDPStatus_MaxClients) {
+          } else if (sdp.status == WuSDPStatus_MaxClients ||
+                     sdp.status == WuSDPStatus_Overloaded) {
             SocketWrite(conn->fd, STRLIT(HTTP_UNAVAILABLE));
           } else if (sdp.status == WuSDPStatus_InvalidSDP) {
             SocketWrite(conn->fd, STRLIT(HTTP_BAD_REQUEST));
@@ -161,16 +277,93 @@ static void HandleHttpRequest(WuHost* host, WuConnectionBuffer* conn) {
   }
 }
 
+static void ReceiveUDP(WuHost* host) {
+  struct sockaddr_in remote;
+  uint8_t buf[4096];
+  uint8_t control[CMSG_SPACE(sizeof(uint32_t))];
+
+  struct iovec iov;
+  iov.iov_base = buf;
+  iov.iov_len = sizeof(buf);
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_name = &remote;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+
+  int32_t received = 0;
+  while (received < kMaxDatagramsPerServe) {
+    msg.msg_namelen = sizeof(remote);
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t r = recvmsg(host->udpfd, &msg, 0);
+    if (r <= 0) {
+      break;
+    }
+
+    // SO_RXQ_OVFL attaches the socket's cumulative drop count.
+    for (struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+      if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+        uint32_t drops;
+        memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+        host->socketStats.kernelDrops = drops;
+      }
+    }
+
+    WuAddress address;
+    address.host = ntohl(remote.sin_addr.s_addr);
+    address.port = ntohs(remote.sin_port);
+
+    if (host->capture) {
+      WuPcapWrite(host->capture, WuPcap_Udp, &address, &host->local, buf, r);
+    }
+
+    WuHandleUDP(host->wu, &address, buf, r);
+    received++;
+  }
+
+  // Edge triggered, the socket won't be reported again until new data
+  // arrives, so remember to come back to it.
+  host->udpPending = received == kMaxDatagramsPerServe;
+  if (host->udpPending) {
+    host->recvBudgetHits++;
+  }
+}
+
+static void UpdateHandshakeRate(WuHost* host, double now) {
+  const double elapsed = now - host->rateWindowStart;
+  if (elapsed < 1.0) {
+    return;
+  }
+
+  const uint64_t handshakes = host->wu->stats.handshakes;
+  host->handshakeRate =
+      double(handshakes - host->rateWindowHandshakes) / elapsed;
+  host->rateWindowHandshakes = handshakes;
+  host->rateWindowStart = now;
+
+  if (host->capture) {
+    fflush(host->capture);
+  }
+}
+
 int32_t WuHostServe(WuHost* host, WuEvent* evt) {
+  const double start = MsNow() * 0.001;
   int32_t hres = WuUpdate(host->wu, evt);
 
   if (hres) {
     return hres;
   }
 
-  int n =
-      epoll_wait(host->epfd, host->events, host->maxEvents, host->pollTimeout);
+  const bool udpPending = host->udpPending;
+  const double waitStart = MsNow() * 0.001;
+  int n = epoll_wait(host->epfd, host->events, host->maxEvents,
+                     udpPending ? 0 : host->pollTimeout);
+  const double waitEnd = MsNow() * 0.001;
 
+  bool udpHandled = false;
   WuConnectionBufferPool* pool = host->bufferPool;
   for (int i = 0; i < n; i++) {
     struct epoll_event* e = &host->events[i];
@@ -205,6 +398,8 @@ int32_t WuHostServe(WuHost* host, WuEvent* evt) {
 
         if (conn) {
           conn->fd = infd;
+          conn->remote.host = ntohl(inAddress.sin_addr.s_addr);
+          conn->remote.port = ntohs(inAddress.sin_port);
           struct epoll_event event;
           event.events = EPOLLIN | EPOLLET;
           event.data.ptr = conn;
@@ -217,24 +412,23 @@ int32_t WuHostServe(WuHost* host, WuEvent* evt) {
         }
       }
     } else if (host->udpfd == c->fd) {
-      struct sockaddr_in remote;
-      socklen_t remoteLen = sizeof(remote);
-      uint8_t buf[4096];
-
-      ssize_t r = 0;
-      while ((r = recvfrom(host->udpfd, buf, sizeof(buf), 0,
-                           (struct sockaddr*)&remote, &remoteLen)) > 0) {
-        WuAddress address;
-        address.host = ntohl(remote.sin_addr.s_addr);
-        address.port = ntohs(remote.sin_port);
-        WuHandleUDP(host->wu, &address, buf, r);
-      }
-
+      ReceiveUDP(host);
+      udpHandled = true;
     } else {
       HandleHttpRequest(host, c);
     }
   }
 
+  if (udpPending && !udpHandled) {
+    ReceiveUDP(host);
+  }
+
+  const double end = MsNow() * 0.001;
+  const double busy = (waitStart - start) + (end - waitEnd);
+  WuHistogramObserve(&host->serveTime, busy);
+  WuOverloadUpdate(host->wu, busy);
+  UpdateHandshakeRate(host, end);
+
   return 0;
 }
 
@@ -269,6 +463,24 @@ int32_t WuHostInit(WuHost* host, const WuConf* conf) {
     return 0;
   }
 
+  int enable = 1;
+  if (setsockopt(host->udpfd, SOL_SOCKET, SO_RXQ_OVFL, &enable,
+                 sizeof(enable)) == -1) {
+    HandleErrno(host, "SO_RXQ_OVFL");
+  }
+
+  if (conf->udpRecvBufferSize > 0 &&
+      SetSocketBufferSize(host->udpfd, SO_RCVBUF, SO_RCVBUFFORCE,
+                          conf->udpRecvBufferSize) == -1) {
+    HandleErrno(host, "SO_RCVBUF");
+  }
+
+  if (conf->udpSendBufferSize > 0 &&
+      SetSocketBufferSize(host->udpfd, SO_SNDBUF, SO_SNDBUFFORCE,
+                          conf->udpSendBufferSize) == -1) {
+    HandleErrno(host, "SO_SNDBUF");
+  }
+
   host->epfd = epoll_create1(0);
   if (host->epfd == -1) {
     HandleErrno(host, "epoll_create");
@@ -277,7 +489,10 @@ int32_t WuHostInit(WuHost* host, const WuConf* conf) {
 
   const int32_t maxEvents = 128;
 
-  host->bufferPool = new WuConnectionBufferPool(maxEvents + 2);
+  void* poolMemory =
+      WuAlloc(&conf->allocator, sizeof(WuConnectionBufferPool));
+  host->bufferPool =
+      new (poolMemory) WuConnectionBufferPool(&conf->allocator, maxEvents + 2);
 
   WuConnectionBuffer* udpBuf = host->bufferPool->GetBuffer();
   udpBuf->fd = host->udpfd;
@@ -303,8 +518,9 @@ int32_t WuHostInit(WuHost* host, const WuConf* conf) {
   }
 
   host->maxEvents = maxEvents;
-  host->events = (struct epoll_event*)calloc(host->maxEvents, sizeof(event));
-  host->wu = (Wu*)calloc(1, sizeof(Wu));
+  host->events = (struct epoll_event*)WuCalloc(
+      &conf->allocator, host->maxEvents, sizeof(event));
+  host->wu = (Wu*)WuCalloc(&conf->allocator, 1, sizeof(Wu));
 
   if (!WuInit(host->wu, conf)) {
     return 0;
@@ -313,6 +529,21 @@ int32_t WuHostInit(WuHost* host, const WuConf* conf) {
   WuSetUserData(host->wu, host);
   WuSetUDPWriteFunction(host->wu, WriteUDPData);
 
+  host->local.host = 0;
+  host->local.port = uint16_t(atoi(conf->port));
+  struct in_addr localAddress;
+  if (inet_pton(AF_INET, conf->host, &localAddress) == 1) {
+    host->local.host = ntohl(localAddress.s_addr);
+  }
+
+  if (conf->captureFile) {
+    host->capture = WuPcapCreate(conf->captureFile);
+    if (!host->capture) {
+      HandleErrno(host, "failed to create capture file");
+    }
+  }
+  host->rateWindowStart = MsNow() * 0.001;
+
   return 1;
 }
 
@@ -330,11 +561,65 @@ int32_t WuHostSendBinary(WuHost* host, WuClient* client, const uint8_t* data,
   return WuSendBinary(host->wu, client, data, length);
 }
 
+int32_t WuHostSendBinaryV(WuHost* host, WuClient* client, const iovec* buffers,
+                          int32_t count) {
+  return WuSendBinaryV(host->wu, client, buffers, count);
+}
+
+int32_t WuHostEnqueueSendText(WuHost* host, WuClient* client,
+                              uint32_t clientId, const char* text,
+                              int32_t length) {
+  return WuEnqueueSendText(host->wu, client, clientId, text, length);
+}
+
+int32_t WuHostEnqueueSendBinary(WuHost* host, WuClient* client,
+                                uint32_t clientId, const uint8_t* data,
+                                int32_t length) {
+  return WuEnqueueSendBinary(host->wu, client, clientId, data, length);
+}
+
+int32_t WuHostEnqueueRemoveClient(WuHost* host, WuClient* client,
+                                  uint32_t clientId) {
+  return WuEnqueueRemoveClient(host->wu, client, clientId);
+}
+
+WuTopic* WuHostCreateTopic(WuHost* host) { return WuCreateTopic(host->wu); }
+
+WuOverloadLevel WuHostGetOverloadLevel(WuHost* host) {
+  return WuGetOverloadLevel(host->wu);
+}
+
+void WuHostDestroyTopic(WuHost* host, WuTopic* topic) {
+  WuDestroyTopic(host->wu, topic);
+}
+
+int32_t WuHostSubscribe(WuHost* host, WuTopic* topic, WuClient* client) {
+  return WuSubscribe(host->wu, topic, client);
+}
+
+void WuHostUnsubscribe(WuHost* host, WuTopic* topic, WuClient* client) {
+  WuUnsubscribe(host->wu, topic, client);
+}
+
+int32_t WuHostPublish(WuHost* host, WuTopic* topic, const uint8_t* data,
+                      int32_t length) {
+  return WuPublish(host->wu, topic, data, length);
+}
+
+int32_t WuHostPublishText(WuHost* host, WuTopic* topic, const char* text,
+                          int32_t length) {
+  return WuPublishText(host->wu, topic, text, length);
+}
+
 WuHost* WuHostCreate(const WuConf* conf) {
-  WuHost* host = (WuHost*)calloc(1, sizeof(WuHost));
+  if (!WuAllocatorValid(&conf->allocator)) {
+    return NULL;
+  }
+
+  WuHost* host = (WuHost*)WuCalloc(&conf->allocator, 1, sizeof(WuHost));
 
   if (!WuHostInit(host, conf)) {
-    free(host);
+    WuFree(&conf->allocator, host);
     return NULL;
   }
 
@@ -344,3 +629,42 @@ WuHost* WuHostCreate(const WuConf* conf) {
 void WuHostSetErrorCallback(WuHost* host, WuErrorFn callback) {
   WuSetErrorCallback(host->wu, callback);
 }
+
+int32_t WuHostDumpRecords(WuHost* host, uint32_t clientId, WuRecordFn fn,
+                          void* userData) {
+  return WuDumpRecords(host->wu, clientId, fn, userData);
+}
+
+void WuHostSetLeaveRecordsCallback(WuHost* host, WuRecordFn fn,
+                                   void* userData) {
+  WuSetLeaveRecordsCallback(host->wu, fn, userData);
+}
+
+int32_t WuHostTopClientsByCost(WuHost* host, WuClientCost* top, int32_t n) {
+  return WuTopClientsByCost(host->wu, top, n);
+}
+
+void WuHostResetClientCosts(WuHost* host) { WuResetClientCosts(host->wu); }
+
+void WuHostGetMemoryStats(WuHost* host, WuMemoryStats* stats) {
+  WuGetMemoryStats(host->wu, stats);
+  stats->connectionBuffers = sizeof(WuConnectionBufferPool) +
+                             WuPoolBytes(host->bufferPool->pool);
+  stats->total += sizeof(WuHost) + stats->connectionBuffers +
+                  size_t(host->maxEvents) * sizeof(struct epoll_event);
+}
+
+void WuHostGetSocketStats(WuHost* host, WuHostSocketStats* stats) {
+  *stats = host->socketStats;
+
+  int size = 0;
+  socklen_t length = sizeof(size);
+  if (getsockopt(host->udpfd, SOL_SOCKET, SO_RCVBUF, &size, &length) == 0) {
+    stats->recvBufferSize = size;
+  }
+
+  length = sizeof(size);
+  if (getsockopt(host->udpfd, SOL_SOCKET, SO_SNDBUF, &size, &length) == 0) {
+    stats->sendBufferSize = size;
+  }
+}
@@ -7,4 +7,33 @@ int32_t WuHostSendText(WuHost*, WuClient*, const char*, int32_t) { return 0; }
 int32_t WuHostSendBinary(WuHost*, WuClient*, const uint8_t*, int32_t) {
   return 0;
 }
+int32_t WuHostSendBinaryV(WuHost*, WuClient*, const iovec*, int32_t) {
+  return 0;
+}
+int32_t WuHostEnqueueSendText(WuHost*, WuClient*, uint32_t, const char*,
+                              int32_t) {
+  return 0;
+}
+int32_t WuHostEnqueueSendBinary(WuHost*, WuClient*, uint32_t, const uint8_t*,
+                                int32_t) {
+  return 0;
+}
+int32_t WuHostEnqueueRemoveClient(WuHost*, WuClient*, uint32_t) { return 0; }
+WuTopic* WuHostCreateTopic(WuHost*) { return NULL; }
+void WuHostDestroyTopic(WuHost*, WuTopic*) {}
+int32_t WuHostSubscribe(WuHost*, WuTopic*, WuClient*) { return 0; }
+void WuHostUnsubscribe(WuHost*, WuTopic*, WuClient*) {}
+int32_t WuHostPublish(WuHost*, WuTopic*, const uint8_t*, int32_t) {
+  return 0;
+}
+int32_t WuHostPublishText(WuHost*, WuTopic*, const char*, int32_t) {
+  return 0;
+}
+WuOverloadLevel WuHostGetOverloadLevel(WuHost*) { return WuOverload_None; }
 void WuHostSetErrorCallback(WuHost*, WuErrorFn) {}
+int32_t WuHostDumpRecords(WuHost*, uint32_t, WuRecordFn, void*) { return 0; }
+void WuHostSetLeaveRecordsCallback(WuHost*, WuRecordFn, void*) {}
+int32_t WuHostTopClientsByCost(WuHost*, WuClientCost*, int32_t) { return 0; }
+void WuHostResetClientCosts(WuHost*) {}
+void WuHostGetMemoryStats(WuHost*, WuMemoryStats*) {}
+void WuHostGetSocketStats(WuHost*, WuHostSocketStats*) {}
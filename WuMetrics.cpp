@@ -0,0 +1,180 @@
+#include "WuMetrics.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include "WuArena.h"
+#include "WuClock.h"
+#include "WuQueue.h"
+
+static const double kHistogramBounds[kWuHistogramBuckets] = {
+    0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+    0.05,   0.1,     0.25,   0.5,   1.0,    2.5,   5.0,  10.0};
+
+static const char* const kClientStateNames[WuClient_NumStates] = {
+    "dead",           "waiting_removal",  "waiting_binding",
+    "dtls_handshake", "sctp_established", "data_channel_open"};
+
+void WuMetricsInit(WuMetricsWriter* w, char* buf, int32_t capacity) {
+  w->buf = buf;
+  w->length = 0;
+  w->capacity = capacity;
+  w->truncated = 0;
+  if (capacity > 0) {
+    buf[0] = '\0';
+  }
+}
+
+void WuMetricsAppend(WuMetricsWriter* w, const char* format, ...) {
+  if (w->truncated) {
+    return;
+  }
+
+  const int32_t remain = w->capacity - w->length;
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(w->buf + w->length, remain, format, args);
+  va_end(args);
+
+  if (n < 0 || n >= remain) {
+    w->truncated = 1;
+    return;
+  }
+
+  w->length += n;
+}
+
+void WuMetricsCounter(WuMetricsWriter* w, const char* name, const char* help,
+                      uint64_t value) {
+  WuMetricsAppend(w, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help,
+                  name, name, (unsigned long long)value);
+}
+
+void WuMetricsGauge(WuMetricsWriter* w, const char* name, const char* help,
+                    double value) {
+  WuMetricsAppend(w, "# HELP %s %s\n# TYPE %s gauge\n%s %.10g\n", name, help,
+                  name, name, value);
+}
+
+void WuMetricsHistogram(WuMetricsWriter* w, const char* name,
+                        const char* help, const WuHistogram* histogram) {
+  WuMetricsAppend(w, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+
+  uint64_t cumulative = 0;
+  for (int32_t i = 0; i < kWuHistogramBuckets; i++) {
+    cumulative += histogram->buckets[i];
+    WuMetricsAppend(w, "%s_bucket{le=\"%g\"} %llu\n", name,
+                    kHistogramBounds[i], (unsigned long long)cumulative);
+  }
+
+  WuMetricsAppend(w, "%s_bucket{le=\"+Inf\"} %llu\n", name,
+                  (unsigned long long)histogram->count);
+  WuMetricsAppend(w, "%s_sum %.6f\n%s_count %llu\n", name, histogram->sum,
+                  name, (unsigned long long)histogram->count);
+}
+
+void WuMetricsWriteCore(WuMetricsWriter* w, const Wu* wu) {
+  int32_t clients[WuClient_NumStates] = {0};
+  for (int32_t i = 0; i < wu->numClients; i++) {
+    clients[WuClientGetState(wu->clients[i])]++;
+  }
+
+  WuMetricsAppend(w,
+                  "# HELP wu_clients Clients by state.\n"
+                  "# TYPE wu_clients gauge\n");
+  for (int32_t i = 0; i < WuClient_NumStates; i++) {
+    WuMetricsAppend(w, "wu_clients{state=\"%s\"} %d\n", kClientStateNames[i],
+                    clients[i]);
+  }
+
+  WuMetricsGauge(w, "wu_clients_hibernated", "Hibernated clients.",
+                 wu->numHibernatedClients);
+  WuMetricsGauge(w, "wu_clients_max", "Client limit.", wu->maxClients);
+
+  const WuStats* stats = &wu->stats;
+  WuMetricsCounter(w, "wu_datagrams_received_total", "UDP datagrams received.",
+                   stats->datagramsIn);
+  WuMetricsCounter(w, "wu_bytes_received_total", "UDP bytes received.",
+                   stats->bytesIn);
+  WuMetricsCounter(w, "wu_datagrams_sent_total", "UDP datagrams sent.",
+                   stats->datagramsOut);
+  WuMetricsCounter(w, "wu_bytes_sent_total", "UDP bytes sent.",
+                   stats->bytesOut);
+  WuMetricsCounter(w, "wu_handshakes_total", "Completed DTLS handshakes.",
+                   stats->handshakes);
+  WuMetricsCounter(w, "wu_sctp_duplicate_tsns_total",
+                   "Duplicate DATA chunks dropped before delivery.",
+                   stats->duplicateTsns);
+  WuMetricsCounter(w, "wu_sctp_data_chunks_received_total",
+                   "SCTP DATA chunks received.", stats->dataChunksIn);
+  WuMetricsCounter(w, "wu_sctp_control_packets_sent_total",
+                   "SCTP packets sent without DATA chunks.",
+                   stats->controlPacketsOut);
+  WuMetricsCounter(w, "wu_sctp_forward_tsns_received_total",
+                   "FORWARD-TSN chunks received.", stats->forwardTsnsIn);
+  WuMetricsCounter(w, "wu_sctp_forward_tsns_sent_total",
+                   "FORWARD-TSN chunks sent.", stats->forwardTsnsOut);
+  WuMetricsCounter(w, "wu_dropped_commands_total",
+                   "Queued commands dropped or refused.",
+                   stats->droppedCommands);
+  WuMetricsCounter(w, "wu_unclassified_datagrams_total",
+                   "Datagrams that are neither STUN nor DTLS.",
+                   stats->unclassifiedDatagrams);
+  WuMetricsCounter(w, "wu_handshake_datagrams_queued_total",
+                   "DTLS handshake datagrams deferred to the handshake queue.",
+                   stats->queuedHandshakeDatagrams);
+  WuMetricsCounter(w, "wu_handshake_datagrams_dropped_total",
+                   "Handshake datagrams dropped, queue full or client gone.",
+                   stats->droppedHandshakeDatagrams);
+  WuMetricsCounter(w, "wu_dropped_events_total",
+                   "Events lost because the event queue couldn't grow.",
+                   stats->droppedEvents);
+  WuMetricsCounter(w, "wu_handshake_budget_hits_total",
+                   "Ticks that left handshakes queued for lack of budget.",
+                   stats->handshakeBudgetHits);
+  WuMetricsCounter(w, "wu_time_sync_packets_total",
+                   "Time sync packets answered.", stats->timeSyncPackets);
+  WuMetricsCounter(w, "wu_overload_refused_offers_total",
+                   "SDP offers refused while overloaded.",
+                   stats->overloadRefusedOffers);
+  WuMetricsCounter(w, "wu_overload_deferred_heartbeats_total",
+                   "Heartbeats deferred while overloaded.",
+                   stats->overloadDeferredHeartbeats);
+  WuMetricsCounter(w, "wu_overload_dropped_messages_total",
+                   "Low priority messages dropped while overloaded.",
+                   stats->overloadDroppedMessages);
+  WuMetricsCounter(w, "wu_overload_disconnects_total",
+                   "Clients disconnected while overloaded.",
+                   stats->overloadDisconnects);
+
+  WuMetricsCounter(w, "wu_unattributed_cycles_total",
+                   "Time spent on datagrams matching no client, "
+                   "in " WU_CYCLE_UNIT ".",
+                   stats->unattributedCycles);
+
+  WuMetricsGauge(w, "wu_overload_level",
+                 "Current WuOverloadLevel, 0 when not overloaded.",
+                 wu->overloadLevel);
+  WuMetricsGauge(w, "wu_arena_high_water_bytes",
+                 "Largest per-tick arena usage.", wu->arena->highWater);
+  WuMetricsGauge(w, "wu_arena_capacity_bytes", "Arena capacity.",
+                 wu->arena->capacity);
+  WuMetricsGauge(w, "wu_handshake_queue_depth",
+                 "Handshake datagrams waiting for the handshake budget.",
+                 wu->handshakeQueue->length);
+  WuMetricsGauge(w, "wu_event_queue_depth", "Events waiting to be polled.",
+                 wu->pendingEvents->length);
+
+  WuMetricsHistogram(w, "wu_join_latency_seconds",
+                     "Time from SDP exchange to data channel open.",
+                     &stats->joinLatency);
+}
+
+void WuHistogramObserve(WuHistogram* histogram, double value) {
+  int32_t i = 0;
+  while (i < kWuHistogramBuckets && value > kHistogramBounds[i]) {
+    i++;
+  }
+
+  histogram->buckets[i]++;
+  histogram->count++;
+  histogram->sum += value;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stdint.h>
+#include "Wu.h"
+
+// Prometheus text exposition written into a caller owned buffer.
+struct WuMetricsWriter {
+  char* buf;
+  int32_t length;
+  int32_t capacity;
+  int32_t truncated;
+};
+
+void WuMetricsInit(WuMetricsWriter* w, char* buf, int32_t capacity);
+void WuMetricsAppend(WuMetricsWriter* w, const char* format, ...)
+    __attribute__((format(printf, 2, 3)));
+void WuMetricsCounter(WuMetricsWriter* w, const char* name, const char* help,
+                      uint64_t value);
+void WuMetricsGauge(WuMetricsWriter* w, const char* name, const char* help,
+                    double value);
+void WuMetricsHistogram(WuMetricsWriter* w, const char* name,
+                        const char* help, const WuHistogram* histogram);
+void WuMetricsWriteCore(WuMetricsWriter* w, const Wu* wu);
+
+void WuHistogramObserve(WuHistogram* histogram, double value);
@@ -96,3 +96,19 @@ int CreateSocket(const char* port, SocketType type) {
 
   return sfd;
 }
+
+int SetSocketBufferSize(int sfd, int option, int forceOption, int size) {
+  // The FORCE variants bypass rmem_max/wmem_max but need CAP_NET_ADMIN.
+  if (setsockopt(sfd, SOL_SOCKET, forceOption, &size, sizeof(size)) == -1 &&
+      setsockopt(sfd, SOL_SOCKET, option, &size, sizeof(size)) == -1) {
+    return -1;
+  }
+
+  int actual = 0;
+  socklen_t length = sizeof(actual);
+  if (getsockopt(sfd, SOL_SOCKET, option, &actual, &length) == -1) {
+    return -1;
+  }
+
+  return actual;
+}
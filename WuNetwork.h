@@ -11,3 +11,4 @@ ssize_t SocketWrite(int fd, const char* buf, size_t len);
 void HexDump(const uint8_t* src, size_t len);
 int MakeNonBlocking(int sfd);
 int CreateSocket(const char* port, SocketType type);
+int SetSocketBufferSize(int sfd, int option, int forceOption, int size);
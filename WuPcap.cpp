@@ -0,0 +1,154 @@
+#include "WuPcap.h"
+#include <string.h>
+#include <sys/time.h>
+#include "WuBufferOp.h"
+
+const uint32_t kPcapMagic = 0xa1b2c3d4;
+const uint32_t kPcapLinkTypeRaw = 101;
+const int32_t kPcapSnapLength = 65535;
+const int32_t kIpHeaderLength = 20;
+const int32_t kUdpHeaderLength = 8;
+const int32_t kTcpHeaderLength = 20;
+
+struct PcapFileHeader {
+  uint32_t magic;
+  uint16_t versionMajor;
+  uint16_t versionMinor;
+  int32_t thisZone;
+  uint32_t sigFigs;
+  uint32_t snapLength;
+  uint32_t linkType;
+};
+
+struct PcapRecordHeader {
+  uint32_t seconds;
+  uint32_t microseconds;
+  uint32_t includedLength;
+  uint32_t originalLength;
+};
+
+FILE* WuPcapCreate(const char* path) {
+  FILE* file = fopen(path, "wb");
+  if (!file) {
+    return NULL;
+  }
+
+  PcapFileHeader header;
+  header.magic = kPcapMagic;
+  header.versionMajor = 2;
+  header.versionMinor = 4;
+  header.thisZone = 0;
+  header.sigFigs = 0;
+  header.snapLength = kPcapSnapLength;
+  header.linkType = kPcapLinkTypeRaw;
+
+  if (fwrite(&header, sizeof(header), 1, file) != 1) {
+    fclose(file);
+    return NULL;
+  }
+
+  return file;
+}
+
+void WuPcapWrite(FILE* file, WuPcapProtocol protocol, const WuAddress* remote,
+                 const WuAddress* local, const uint8_t* data, int32_t length) {
+  const int32_t transportLength =
+      protocol == WuPcap_Udp ? kUdpHeaderLength : kTcpHeaderLength;
+  const int32_t total = kIpHeaderLength + transportLength + length;
+  if (total > kPcapSnapLength) {
+    return;
+  }
+
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+
+  PcapRecordHeader record;
+  record.seconds = uint32_t(tv.tv_sec);
+  record.microseconds = uint32_t(tv.tv_usec);
+  record.includedLength = uint32_t(total);
+  record.originalLength = uint32_t(total);
+
+  uint8_t headers[kIpHeaderLength + kTcpHeaderLength];
+  memset(headers, 0, sizeof(headers));
+
+  uint8_t* ip = headers;
+  ip[0] = 0x45;
+  WriteScalarSwapped(ip + 2, uint16_t(total));
+  ip[8] = 64;
+  ip[9] = uint8_t(protocol);
+  WriteScalarSwapped(ip + 12, remote->host);
+  WriteScalarSwapped(ip + 16, local->host);
+
+  uint8_t* transport = headers + kIpHeaderLength;
+  WriteScalarSwapped(transport, remote->port);
+  WriteScalarSwapped(transport + 2, local->port);
+
+  if (protocol == WuPcap_Udp) {
+    WriteScalarSwapped(transport + 4, uint16_t(kUdpHeaderLength + length));
+  } else {
+    transport[12] = (kTcpHeaderLength / 4) << 4;
+    transport[13] = 0x18;  // PSH, ACK
+    WriteScalarSwapped(transport + 14, uint16_t(0xffff));
+  }
+
+  fwrite(&record, sizeof(record), 1, file);
+  fwrite(headers, kIpHeaderLength + transportLength, 1, file);
+  fwrite(data, length, 1, file);
+}
+
+FILE* WuPcapOpen(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return NULL;
+  }
+
+  PcapFileHeader header;
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != kPcapMagic || header.linkType != kPcapLinkTypeRaw) {
+    fclose(file);
+    return NULL;
+  }
+
+  return file;
+}
+
+int32_t WuPcapRead(FILE* file, uint8_t* buf, int32_t capacity,
+                   WuPcapPacket* packet) {
+  for (;;) {
+    PcapRecordHeader record;
+    if (fread(&record, sizeof(record), 1, file) != 1 ||
+        record.includedLength > uint32_t(capacity) ||
+        fread(buf, record.includedLength, 1, file) != 1) {
+      return 0;
+    }
+
+    const int32_t length = int32_t(record.includedLength);
+    if (length < kIpHeaderLength || (buf[0] >> 4) != 4) {
+      continue;
+    }
+
+    const int32_t ipLength = (buf[0] & 0x0f) * 4;
+    const uint8_t protocol = buf[9];
+    int32_t transportLength = 0;
+
+    if (protocol == WuPcap_Udp) {
+      transportLength = kUdpHeaderLength;
+    } else if (protocol == WuPcap_Tcp && length >= ipLength + 13) {
+      transportLength = (buf[ipLength + 12] >> 4) * 4;
+    } else {
+      continue;
+    }
+
+    if (length < ipLength + transportLength) {
+      continue;
+    }
+
+    packet->time = double(record.seconds) + record.microseconds * 1e-6;
+    packet->protocol = WuPcapProtocol(protocol);
+    ReadScalarSwapped(buf + 12, &packet->remote.host);
+    ReadScalarSwapped(buf + ipLength, &packet->remote.port);
+    packet->data = buf + ipLength + transportLength;
+    packet->length = length - ipLength - transportLength;
+    return 1;
+  }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include "Wu.h"
+
+// pcap files with LINKTYPE_RAW (IPv4) records. Inbound datagrams are stored
+// as UDP packets, SDP offers as a single TCP segment carrying the request
+// body. IP and transport headers are synthesized, checksums are left zero.
+
+enum WuPcapProtocol { WuPcap_Tcp = 6, WuPcap_Udp = 17 };
+
+struct WuPcapPacket {
+  double time;
+  WuPcapProtocol protocol;
+  WuAddress remote;
+  const uint8_t* data;
+  int32_t length;
+};
+
+FILE* WuPcapCreate(const char* path);
+void WuPcapWrite(FILE* file, WuPcapProtocol protocol, const WuAddress* remote,
+                 const WuAddress* local, const uint8_t* data, int32_t length);
+
+FILE* WuPcapOpen(const char* path);
+// Reads the next packet into buf, returns 0 at the end of the file.
+int32_t WuPcapRead(FILE* file, uint8_t* buf, int32_t capacity,
+                   WuPcapPacket* packet);
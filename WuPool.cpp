@@ -1,51 +1,128 @@
 #include "WuPool.h"
 #include <assert.h>
-#include <stdlib.h>
+#include "Wu.h"
+#include "WuAlloc.h"
 
 struct BlockHeader {
   int32_t index;
 };
 
+// Blocks are allocated in chunks which never move, so pointers handed out
+// by WuPoolAcquire stay valid while the pool grows and shrinks.
+struct WuPoolChunk {
+  uint8_t* memory;
+  int32_t used;
+};
+
 struct WuPool {
+  WuAllocator allocator;
   int32_t slotSize;
-  int32_t numBytes;
+  int32_t chunkBlocks;
+  int32_t maxBlocks;
+  int32_t maxChunks;
   int32_t numBlocks;
-  uint8_t* memory;
+  int32_t emptyChunks;
+  WuPoolChunk* chunks;
   int32_t freeIndicesCount;
+  int32_t freeIndicesCapacity;
   int32_t* freeIndices;
 };
 
-WuPool* WuPoolCreate(int32_t blockSize, int32_t numBlocks) {
-  WuPool* pool = (WuPool*)calloc(1, sizeof(WuPool));
+static int32_t ChunkBlocks(const WuPool* pool, int32_t chunk) {
+  int32_t remain = pool->maxBlocks - chunk * pool->chunkBlocks;
+  return remain < pool->chunkBlocks ? remain : pool->chunkBlocks;
+}
+
+static int32_t WuPoolGrow(WuPool* pool) {
+  int32_t chunk = 0;
+  while (chunk < pool->maxChunks && pool->chunks[chunk].memory) {
+    chunk++;
+  }
+
+  if (chunk == pool->maxChunks) {
+    return 0;
+  }
+
+  const int32_t numBlocks = ChunkBlocks(pool, chunk);
+  const int32_t newCapacity = pool->numBlocks + numBlocks;
+
+  if (newCapacity > pool->freeIndicesCapacity) {
+    int32_t* freeIndices = (int32_t*)WuRealloc(
+        &pool->allocator, pool->freeIndices, newCapacity * sizeof(int32_t));
+    if (!freeIndices) {
+      return 0;
+    }
+    pool->freeIndices = freeIndices;
+    pool->freeIndicesCapacity = newCapacity;
+  }
 
+  uint8_t* memory =
+      (uint8_t*)WuCalloc(&pool->allocator, numBlocks, pool->slotSize);
+  if (!memory) {
+    return 0;
+  }
+
+  pool->chunks[chunk].memory = memory;
+  pool->chunks[chunk].used = 0;
+  pool->numBlocks = newCapacity;
+  pool->emptyChunks++;
+
+  const int32_t first = chunk * pool->chunkBlocks;
+  for (int32_t i = numBlocks - 1; i >= 0; i--) {
+    pool->freeIndices[pool->freeIndicesCount++] = first + i;
+  }
+
+  return 1;
+}
+
+WuPool* WuPoolCreate(const WuAllocator* allocator, int32_t blockSize,
+                     int32_t chunkBlocks, int32_t maxBlocks) {
+  assert(chunkBlocks > 0 && maxBlocks > 0);
+  WuPool* pool = (WuPool*)WuCalloc(allocator, 1, sizeof(WuPool));
+  if (!pool) {
+    return NULL;
+  }
+
+  pool->allocator = *allocator;
   pool->slotSize = blockSize + sizeof(BlockHeader);
-  pool->numBytes = pool->slotSize * numBlocks;
-  pool->numBlocks = numBlocks;
-  pool->memory = (uint8_t*)calloc(pool->numBytes, 1);
-  pool->freeIndicesCount = numBlocks;
-  pool->freeIndices = (int32_t*)calloc(numBlocks, sizeof(int32_t));
+  pool->chunkBlocks = chunkBlocks < maxBlocks ? chunkBlocks : maxBlocks;
+  pool->maxBlocks = maxBlocks;
+  pool->maxChunks = (maxBlocks + pool->chunkBlocks - 1) / pool->chunkBlocks;
+  pool->chunks = (WuPoolChunk*)WuCalloc(allocator, pool->maxChunks,
+                                        sizeof(WuPoolChunk));
 
-  for (int32_t i = 0; i < numBlocks; i++) {
-    pool->freeIndices[i] = numBlocks - i - 1;
+  if (!pool->chunks || !WuPoolGrow(pool)) {
+    WuPoolDestroy(pool);
+    return NULL;
   }
 
   return pool;
 }
 
 void WuPoolDestroy(WuPool* pool) {
-  free(pool->memory);
-  free(pool->freeIndices);
-  free(pool);
+  const WuAllocator allocator = pool->allocator;
+  for (int32_t i = 0; i < pool->maxChunks; i++) {
+    WuFree(&allocator, pool->chunks[i].memory);
+  }
+  WuFree(&allocator, pool->chunks);
+  WuFree(&allocator, pool->freeIndices);
+  WuFree(&allocator, pool);
 }
 
 void* WuPoolAcquire(WuPool* pool) {
-  if (pool->freeIndicesCount == 0) return NULL;
+  if (pool->freeIndicesCount == 0 && !WuPoolGrow(pool)) return NULL;
 
   const int32_t index = pool->freeIndices[pool->freeIndicesCount - 1];
   pool->freeIndicesCount--;
-  const int32_t offset = index * pool->slotSize;
 
-  uint8_t* block = pool->memory + offset;
+  WuPoolChunk* chunk = &pool->chunks[index / pool->chunkBlocks];
+  if (chunk->used++ == 0) {
+    pool->emptyChunks--;
+  }
+
+  const int32_t offset = (index % pool->chunkBlocks) * pool->slotSize;
+
+  uint8_t* block = chunk->memory + offset;
   BlockHeader* header = (BlockHeader*)block;
   header->index = index;
 
@@ -57,4 +134,70 @@ void WuPoolRelease(WuPool* pool, void* ptr) {
   uint8_t* mem = (uint8_t*)ptr - sizeof(BlockHeader);
   BlockHeader* header = (BlockHeader*)mem;
   pool->freeIndices[pool->freeIndicesCount++] = header->index;
+
+  WuPoolChunk* chunk = &pool->chunks[header->index / pool->chunkBlocks];
+  if (--chunk->used == 0) {
+    pool->emptyChunks++;
+  }
+}
+
+int32_t WuPoolContains(const WuPool* pool, const void* ptr) {
+  const uint8_t* p = (const uint8_t*)ptr;
+  for (int32_t i = 0; i < pool->maxChunks; i++) {
+    const uint8_t* memory = pool->chunks[i].memory;
+    if (!memory || p < memory) {
+      continue;
+    }
+
+    const size_t offset = size_t(p - memory);
+    if (offset < size_t(ChunkBlocks(pool, i)) * pool->slotSize) {
+      return offset % pool->slotSize == sizeof(BlockHeader);
+    }
+  }
+
+  return 0;
+}
+
+int32_t WuPoolCapacity(const WuPool* pool) { return pool->numBlocks; }
+
+int32_t WuPoolEmptyChunks(const WuPool* pool) { return pool->emptyChunks; }
+
+size_t WuPoolBytes(const WuPool* pool) {
+  return sizeof(WuPool) + size_t(pool->maxChunks) * sizeof(WuPoolChunk) +
+         size_t(pool->freeIndicesCapacity) * sizeof(int32_t) +
+         size_t(pool->numBlocks) * pool->slotSize;
+}
+
+void WuPoolShrink(WuPool* pool, int32_t keepEmptyChunks) {
+  int32_t toRelease = pool->emptyChunks - keepEmptyChunks;
+  if (toRelease <= 0) {
+    return;
+  }
+
+  // The first chunk is never released, the pool keeps its initial capacity.
+  for (int32_t i = pool->maxChunks - 1; i > 0 && toRelease > 0; i--) {
+    WuPoolChunk* chunk = &pool->chunks[i];
+    if (!chunk->memory || chunk->used > 0) {
+      continue;
+    }
+
+    const int32_t first = i * pool->chunkBlocks;
+    const int32_t last = first + ChunkBlocks(pool, i);
+
+    int32_t kept = 0;
+    for (int32_t j = 0; j < pool->freeIndicesCount; j++) {
+      int32_t index = pool->freeIndices[j];
+      if (index < first || index >= last) {
+        pool->freeIndices[kept++] = index;
+      }
+    }
+
+    pool->freeIndicesCount = kept;
+    pool->numBlocks -= last - first;
+    pool->emptyChunks--;
+    toRelease--;
+
+    WuFree(&pool->allocator, chunk->memory);
+    chunk->memory = NULL;
+  }
 }
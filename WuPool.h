@@ -1,10 +1,19 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
+struct WuAllocator;
 struct WuPool;
 
-WuPool* WuPoolCreate(int32_t blockSize, int32_t numBlocks);
+WuPool* WuPoolCreate(const WuAllocator* allocator, int32_t blockSize,
+                     int32_t chunkBlocks, int32_t maxBlocks);
 void WuPoolDestroy(WuPool* pool);
 void* WuPoolAcquire(WuPool* pool);
 void WuPoolRelease(WuPool* pool, void* ptr);
+// Whether ptr is a block handed out by a chunk the pool currently holds.
+int32_t WuPoolContains(const WuPool* pool, const void* ptr);
+int32_t WuPoolCapacity(const WuPool* pool);
+int32_t WuPoolEmptyChunks(const WuPool* pool);
+void WuPoolShrink(WuPool* pool, int32_t keepEmptyChunks);
+size_t WuPoolBytes(const WuPool* pool);
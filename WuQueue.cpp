@@ -1,6 +1,7 @@
 #include "WuQueue.h"
-#include <stdlib.h>
 #include <string.h>
+#include "WuAlloc.h"
+#include "WuTrace.h"
 
 static int32_t WuQueueFull(const WuQueue* q) {
   if (q->length == q->capacity) {
@@ -10,30 +11,38 @@ static int32_t WuQueueFull(const WuQueue* q) {
   return 0;
 }
 
-WuQueue* WuQueueCreate(int32_t itemSize, int32_t capacity) {
-  WuQueue* q = (WuQueue*)calloc(1, sizeof(WuQueue));
-  WuQueueInit(q, itemSize, capacity);
+WuQueue* WuQueueCreate(const WuAllocator* allocator, int32_t itemSize,
+                       int32_t capacity) {
+  WuQueue* q = (WuQueue*)WuCalloc(allocator, 1, sizeof(WuQueue));
+  WuQueueInit(q, allocator, itemSize, capacity);
   return q;
 }
 
-void WuQueueInit(WuQueue* q, int32_t itemSize, int32_t capacity) {
-  memset(q, 0, sizeof(WuQueue));
+void WuQueueInit(WuQueue* q, const WuAllocator* allocator, int32_t itemSize,
+                 int32_t capacity) {
+  *q = WuQueue();
+  q->allocator = *allocator;
   q->itemSize = itemSize;
   q->capacity = capacity;
-  q->items = (uint8_t*)calloc(q->capacity, itemSize);
+  q->items = (uint8_t*)WuCalloc(allocator, q->capacity, itemSize);
 }
 
-void WuQueuePush(WuQueue* q, const void* item) {
+int32_t WuQueuePush(WuQueue* q, const void* item) {
   if (WuQueueFull(q)) {
     int32_t newCap = q->capacity * 1.5;
-    uint8_t* newItems = (uint8_t*)calloc(newCap, q->itemSize);
+    WU_TRACE3(queue_grow, q, q->capacity, newCap);
+    uint8_t* newItems =
+        (uint8_t*)WuCalloc(&q->allocator, newCap, q->itemSize);
+    if (!newItems) {
+      return 0;
+    }
 
     int32_t nUpper = q->length - q->start;
     int32_t nLower = q->length - nUpper;
     memcpy(newItems, q->items + q->start * q->itemSize, q->itemSize * nUpper);
     memcpy(newItems + q->itemSize * nUpper, q->items, q->itemSize * nLower);
 
-    free(q->items);
+    WuFree(&q->allocator, q->items);
 
     q->start = 0;
     q->capacity = newCap;
@@ -44,6 +53,7 @@ void WuQueuePush(WuQueue* q, const void* item) {
       ((q->start + q->length) % q->capacity) * q->itemSize;
   memcpy(q->items + insertIdx, item, q->itemSize);
   q->length++;
+  return 1;
 }
 
 int32_t WuQueuePop(WuQueue* q, void* item) {
@@ -1,8 +1,10 @@
 #pragma once
 
 #include <stdint.h>
+#include "Wu.h"
 
 struct WuQueue {
+  WuAllocator allocator;
   int32_t itemSize;
   int32_t start;
   int32_t length;
@@ -10,7 +12,9 @@ struct WuQueue {
   uint8_t* items;
 };
 
-WuQueue* WuQueueCreate(int32_t itemSize, int32_t capacity);
-void WuQueueInit(WuQueue* q, int32_t itemSize, int32_t capacity);
-void WuQueuePush(WuQueue* q, const void* item);
+WuQueue* WuQueueCreate(const WuAllocator* allocator, int32_t itemSize,
+                       int32_t capacity);
+void WuQueueInit(WuQueue* q, const WuAllocator* allocator, int32_t itemSize,
+                 int32_t capacity);
+int32_t WuQueuePush(WuQueue* q, const void* item);
 int32_t WuQueuePop(WuQueue* q, void* item);
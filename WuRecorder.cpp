@@ -0,0 +1,52 @@
+#include "WuRecorder.h"
+#include "WuAlloc.h"
+
+void WuRecorderInit(WuRecorder* recorder, const WuAllocator* allocator,
+                    int32_t capacity, double epoch) {
+  recorder->allocator = *allocator;
+  recorder->records = NULL;
+  recorder->mask = 0;
+  recorder->head = 0;
+  recorder->epoch = epoch;
+
+  if (capacity <= 0) {
+    return;
+  }
+
+  uint32_t size = 1;
+  while (size < uint32_t(capacity)) {
+    size <<= 1;
+  }
+
+  recorder->records = (WuRecord*)WuCalloc(allocator, size, sizeof(WuRecord));
+  if (recorder->records) {
+    recorder->mask = size - 1;
+  }
+}
+
+void WuRecorderDestroy(WuRecorder* recorder) {
+  WuFree(&recorder->allocator, recorder->records);
+  recorder->records = NULL;
+}
+
+int32_t WuRecorderForEach(const WuRecorder* recorder, uint32_t clientId,
+                          WuRecordFn fn, void* userData) {
+  if (!recorder->records) {
+    return 0;
+  }
+
+  const uint64_t size = recorder->mask + 1;
+  const uint64_t end = recorder->head;
+  const uint64_t begin = end > size ? end - size : 0;
+
+  int32_t count = 0;
+  for (uint64_t i = begin; i != end; i++) {
+    const WuRecord* record = &recorder->records[i & recorder->mask];
+    if (clientId == 0 || record->clientId == clientId) {
+      fn(record, userData);
+      count++;
+    }
+  }
+
+  return count;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include "Wu.h"
+
+// Fixed size ring of the most recent protocol events, overwritten oldest
+// first. Written only from the thread running Wu.
+struct WuRecorder {
+  WuAllocator allocator;
+  WuRecord* records;
+  uint32_t mask;
+  uint64_t head;
+  double epoch;
+};
+
+void WuRecorderInit(WuRecorder* recorder, const WuAllocator* allocator,
+                    int32_t capacity, double epoch);
+void WuRecorderDestroy(WuRecorder* recorder);
+int32_t WuRecorderForEach(const WuRecorder* recorder, uint32_t clientId,
+                          WuRecordFn fn, void* userData);
+
+inline void WuRecorderPush(WuRecorder* recorder, double time,
+                           uint32_t clientId, WuRecordType type,
+                           uint8_t subtype = 0, uint32_t value = 0,
+                           uint16_t length = 0) {
+  if (!recorder->records) {
+    return;
+  }
+
+  WuRecord* record = &recorder->records[recorder->head++ & recorder->mask];
+  record->time = uint32_t((time - recorder->epoch) * 1000.0);
+  record->clientId = clientId;
+  record->type = uint8_t(type);
+  record->subtype = subtype;
+  record->length = length;
+  record->value = value;
+}
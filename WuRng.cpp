@@ -1,5 +1,5 @@
 #include "WuRng.h"
-#include <x86intrin.h>
+#include "WuClock.h"
 
 static const char kCharacterTable[] =
     "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
@@ -9,7 +9,7 @@ static inline uint64_t rotl(const uint64_t x, int k) {
 }
 
 uint64_t WuGetRngSeed() {
-  uint64_t x = __rdtsc();
+  uint64_t x = CycleCounter();
   uint64_t z = (x += UINT64_C(0x9E3779B97F4A7C15));
   z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
   z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
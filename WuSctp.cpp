@@ -2,6 +2,7 @@
 #include <arpa/inet.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/uio.h>
 #include "CRC32.h"
 #include "WuBufferOp.h"
 #include "WuMath.h"
@@ -28,6 +29,10 @@ int32_t ParseSctpPacket(const uint8_t* buf, size_t len, SctpPacket* packet,
     offset += ReadScalarSwapped(buf + offset, &chunk->flags);
     offset += ReadScalarSwapped(buf + offset, &chunk->length);
 
+    if (chunk->length < 4 || chunk->length > left) {
+      return 0;
+    }
+
     *nChunk += 1;
 
     if (chunk->type == Sctp_Data) {
@@ -40,6 +45,8 @@ int32_t ParseSctpPacket(const uint8_t* buf, size_t len, SctpPacket* packet,
       chunkOffset += ReadScalarSwapped(buf + offset + chunkOffset, &p->protoId);
       p->userDataLength = Max(int32_t(chunk->length) - 16, 0);
       p->userData = buf + offset + chunkOffset;
+      p->userDataV = NULL;
+      p->userDataVCount = 0;
     } else if (chunk->type == Sctp_Sack) {
       auto* sack = &chunk->as.sack;
       size_t chunkOffset =
@@ -49,7 +56,10 @@ int32_t ParseSctpPacket(const uint8_t* buf, size_t len, SctpPacket* packet,
       chunkOffset +=
           ReadScalarSwapped(buf + offset + chunkOffset, &sack->numGapAckBlocks);
       ReadScalarSwapped(buf + offset + chunkOffset, &sack->numDupTsn);
-    } else if (chunk->type == Sctp_Heartbeat) {
+      sack->gapAckBlocks = NULL;
+      sack->dupTsns = NULL;
+    } else if (chunk->type == Sctp_Heartbeat ||
+               chunk->type == Sctp_HeartbeatAck) {
       auto* p = &chunk->as.heartbeat;
       size_t chunkOffset = 2;  // skip type
       uint16_t heartbeatLen;
@@ -57,6 +67,10 @@ int32_t ParseSctpPacket(const uint8_t* buf, size_t len, SctpPacket* packet,
           ReadScalarSwapped(buf + offset + chunkOffset, &heartbeatLen);
       p->heartbeatInfoLen = int32_t(heartbeatLen) - 4;
       p->heartbeatInfo = buf + offset + chunkOffset;
+      if (p->heartbeatInfoLen < 0 ||
+          p->heartbeatInfoLen > int32_t(chunk->length) - 8) {
+        return 0;
+      }
     } else if (chunk->type == Sctp_Init) {
       size_t chunkOffset =
           ReadScalarSwapped(buf + offset, &chunk->as.init.initiateTag);
@@ -67,6 +81,10 @@ int32_t ParseSctpPacket(const uint8_t* buf, size_t len, SctpPacket* packet,
       chunkOffset += ReadScalarSwapped(buf + offset + chunkOffset,
                                        &chunk->as.init.numInboundStreams);
       ReadScalarSwapped(buf + offset + chunkOffset, &chunk->as.init.initialTsn);
+    } else if (chunk->type == SctpChunk_ForwardTsn) {
+      // The stream and sequence pairs after it only matter for ordered
+      // delivery.
+      ReadScalarSwapped(buf + offset, &chunk->as.forwardTsn.newCumulativeTsn);
     }
 
     int32_t valueLength = chunk->length - 4;
@@ -78,8 +96,41 @@ int32_t ParseSctpPacket(const uint8_t* buf, size_t len, SctpPacket* packet,
   return 1;
 }
 
+size_t SctpSerializedChunkLength(const SctpChunk* chunk) {
+  switch (chunk->type) {
+    case Sctp_Data: {
+      const int32_t length = chunk->as.data.userDataLength;
+      return size_t(16 + length + PadSize(length, 4));
+    }
+    case Sctp_InitAck:
+      return kSctpMinInitAckLength;
+    case Sctp_Sack:
+      return 16 + 4 * size_t(chunk->as.sack.numGapAckBlocks) +
+             4 * size_t(chunk->as.sack.numDupTsn);
+    case Sctp_Heartbeat:
+    case Sctp_HeartbeatAck: {
+      const int32_t length = chunk->as.heartbeat.heartbeatInfoLen;
+      return size_t(8 + length + PadSize(length, 4));
+    }
+    case Sctp_Shutdown:
+    case SctpChunk_ForwardTsn:
+      return 8;
+    default:
+      return 4;
+  }
+}
+
 size_t SerializeSctpPacket(const SctpPacket* packet, const SctpChunk* chunks,
                            size_t numChunks, uint8_t* dst, size_t dstLen) {
+  size_t total = kSctpHeaderLength;
+  for (size_t i = 0; i < numChunks; i++) {
+    total += SctpSerializedChunkLength(&chunks[i]);
+  }
+
+  if (total > dstLen) {
+    return 0;
+  }
+
   size_t offset = WriteScalar(dst, htons(packet->sourcePort));
   offset += WriteScalar(dst + offset, htons(packet->destionationPort));
   offset += WriteScalar(dst + offset, htonl(packet->verificationTag));
@@ -101,8 +152,22 @@ size_t SerializeSctpPacket(const SctpPacket* packet, const SctpChunk* chunks,
         offset += WriteScalar(dst + offset, htons(dc->streamId));
         offset += WriteScalar(dst + offset, htons(dc->streamSeq));
         offset += WriteScalar(dst + offset, htonl(dc->protoId));
-        memcpy(dst + offset, dc->userData, dc->userDataLength);
+        if (!dc->userData) {
+          size_t gathered = 0;
+          for (int32_t v = 0; v < dc->userDataVCount; v++) {
+            // An empty entry may have a NULL iov_base.
+            if (dc->userDataV[v].iov_len == 0) {
+              continue;
+            }
+            memcpy(dst + offset + gathered, dc->userDataV[v].iov_base,
+                   dc->userDataV[v].iov_len);
+            gathered += dc->userDataV[v].iov_len;
+          }
+        } else {
+          memcpy(dst + offset, dc->userData, dc->userDataLength);
+        }
         int32_t pad = PadSize(dc->userDataLength, 4);
+        memset(dst + offset + dc->userDataLength, 0, pad);
         offset += dc->userDataLength + pad;
         break;
       }
@@ -129,6 +194,12 @@ size_t SerializeSctpPacket(const SctpPacket* packet, const SctpChunk* chunks,
         offset += WriteScalar(dst + offset, htonl(sack->advRecvWindow));
         offset += WriteScalar(dst + offset, htons(sack->numGapAckBlocks));
         offset += WriteScalar(dst + offset, htons(sack->numDupTsn));
+        for (uint16_t i = 0; i < 2 * sack->numGapAckBlocks; i++) {
+          offset += WriteScalar(dst + offset, htons(sack->gapAckBlocks[i]));
+        }
+        for (uint16_t i = 0; i < sack->numDupTsn; i++) {
+          offset += WriteScalar(dst + offset, htonl(sack->dupTsns[i]));
+        }
         break;
       }
       case Sctp_Heartbeat:
@@ -136,8 +207,12 @@ size_t SerializeSctpPacket(const SctpPacket* packet, const SctpChunk* chunks,
         auto* hb = &chunk->as.heartbeat;
         offset += WriteScalar(dst + offset, htons(1));
         offset += WriteScalar(dst + offset, htons(hb->heartbeatInfoLen + 4));
-        memcpy(dst + offset, hb->heartbeatInfo, hb->heartbeatInfoLen);
-        offset += hb->heartbeatInfoLen + PadSize(hb->heartbeatInfoLen, 4);
+        if (hb->heartbeatInfoLen > 0) {
+          memcpy(dst + offset, hb->heartbeatInfo, hb->heartbeatInfoLen);
+        }
+        const int32_t pad = PadSize(hb->heartbeatInfoLen, 4);
+        memset(dst + offset + hb->heartbeatInfoLen, 0, pad);
+        offset += hb->heartbeatInfoLen + pad;
         break;
       }
       case Sctp_Shutdown: {
@@ -162,8 +237,115 @@ size_t SerializeSctpPacket(const SctpPacket* packet, const SctpChunk* chunks,
   return offset;
 }
 
+void SctpPatchDataPacket(uint8_t* packet, size_t length,
+                         uint16_t destinationPort, uint32_t verificationTag,
+                         uint32_t tsn) {
+  WriteScalar(packet + 2, htons(destinationPort));
+  WriteScalar(packet + 4, htonl(verificationTag));
+  WriteScalar(packet + 8, uint32_t(0));
+  WriteScalar(packet + 12 + 4, htonl(tsn));
+
+  uint32_t crc = SctpCRC32(packet, int32_t(length));
+  WriteScalar(packet + 8, htonl(crc));
+}
+
 int32_t SctpDataChunkLength(int32_t userDataLength) {
   return 16 + userDataLength;
 }
 
 int32_t SctpChunkLength(int32_t contentLength) { return 4 + contentLength; }
+
+void SctpTsnTrackerInit(SctpTsnTracker* tracker, uint32_t initialTsn) {
+  tracker->cumulativeTsn = initialTsn - 1;
+  memset(tracker->window, 0, sizeof(tracker->window));
+}
+
+static void SctpTsnTrackerShift(SctpTsnTracker* tracker, int32_t n) {
+  const int32_t numWords = kSctpTsnWindow / 64;
+  const int32_t words = n / 64;
+  const int32_t bits = n % 64;
+
+  for (int32_t i = 0; i < numWords; i++) {
+    const int32_t src = i + words;
+    uint64_t word = src < numWords ? tracker->window[src] >> bits : 0;
+    if (bits > 0 && src + 1 < numWords) {
+      word |= tracker->window[src + 1] << (64 - bits);
+    }
+    tracker->window[i] = word;
+  }
+
+  tracker->cumulativeTsn += uint32_t(n);
+}
+
+// Moves the cumulative TSN over the received run at the start of the window.
+static void SctpTsnTrackerAdvance(SctpTsnTracker* tracker) {
+  int32_t received = 0;
+  while (received < kSctpTsnWindow &&
+         (tracker->window[received / 64] >> (received % 64)) & 1) {
+    received++;
+  }
+
+  if (received > 0) {
+    SctpTsnTrackerShift(tracker, received);
+  }
+}
+
+int32_t SctpTsnTrackerAdd(SctpTsnTracker* tracker, uint32_t tsn) {
+  // Serial number arithmetic, TSNs wrap around.
+  int32_t offset = int32_t(tsn - tracker->cumulativeTsn) - 1;
+  if (offset < 0) {
+    return 0;
+  }
+
+  if (offset >= kSctpTsnWindow) {
+    const int32_t slide = offset - kSctpTsnWindow + 1;
+    SctpTsnTrackerShift(tracker, Min(slide, kSctpTsnWindow));
+    tracker->cumulativeTsn = tsn - kSctpTsnWindow;
+    offset = kSctpTsnWindow - 1;
+  }
+
+  uint64_t* word = &tracker->window[offset / 64];
+  const uint64_t bit = uint64_t(1) << (offset % 64);
+  if (*word & bit) {
+    return 0;
+  }
+
+  *word |= bit;
+  SctpTsnTrackerAdvance(tracker);
+
+  return 1;
+}
+
+void SctpTsnTrackerForward(SctpTsnTracker* tracker, uint32_t newCumulativeTsn) {
+  const int32_t ahead = int32_t(newCumulativeTsn - tracker->cumulativeTsn);
+  if (ahead <= 0) {
+    return;
+  }
+
+  SctpTsnTrackerShift(tracker, Min(ahead, kSctpTsnWindow));
+  tracker->cumulativeTsn = newCumulativeTsn;
+
+  // TSNs received past the forwarded point may now be contiguous.
+  SctpTsnTrackerAdvance(tracker);
+}
+
+int32_t SctpTsnTrackerGapBlocks(const SctpTsnTracker* tracker,
+                                uint16_t* blocks, int32_t maxBlocks) {
+  int32_t numBlocks = 0;
+  int32_t start = -1;
+
+  for (int32_t i = 0; i <= kSctpTsnWindow && numBlocks < maxBlocks; i++) {
+    const bool received =
+        i < kSctpTsnWindow && (tracker->window[i / 64] >> (i % 64)) & 1;
+    if (received && start < 0) {
+      start = i;
+    } else if (!received && start >= 0) {
+      blocks[2 * numBlocks] = uint16_t(start + 1);
+      blocks[2 * numBlocks + 1] = uint16_t(i);
+      numBlocks++;
+      start = -1;
+    }
+  }
+
+  return numBlocks;
+}
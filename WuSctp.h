@@ -3,8 +3,14 @@
 #include <stddef.h>
 #include <stdint.h>
 
+struct iovec;
+
 const uint32_t kSctpDefaultBufferSpace = 1 << 18;
 const uint32_t kSctpMinInitAckLength = 32;
+const int32_t kSctpTsnWindow = 256;
+const int32_t kSctpMaxGapBlocks = 16;
+// Ports, verification tag and checksum.
+const int32_t kSctpHeaderLength = 12;
 
 enum SctpFlag {
   SctpFlagEndFragment = 0x01,
@@ -51,6 +57,9 @@ struct SctpChunk {
       uint32_t protoId;
       int32_t userDataLength;
       const uint8_t* userData;
+      // With a NULL userData the payload is gathered from these.
+      const iovec* userDataV;
+      int32_t userDataVCount;
     } data;
 
     struct {
@@ -71,6 +80,10 @@ struct SctpChunk {
       uint32_t advRecvWindow;
       uint16_t numGapAckBlocks;
       uint16_t numDupTsn;
+      // Serialized after the header, not filled in by ParseSctpPacket. Gap
+      // blocks are start and end offsets from cumulativeTsnAck.
+      const uint16_t* gapAckBlocks;
+      const uint32_t* dupTsns;
     } sack;
 
     struct {
@@ -83,6 +96,24 @@ struct SctpChunk {
   } as;
 };
 
+// Receive side TSN bookkeeping. Every TSN up to cumulativeTsn has been
+// received or given up on, bit i of the window is TSN cumulativeTsn + 1 + i.
+// A TSN past the window slides it forward, dropping the oldest gaps.
+struct SctpTsnTracker {
+  uint32_t cumulativeTsn;
+  uint64_t window[kSctpTsnWindow / 64];
+};
+
+void SctpTsnTrackerInit(SctpTsnTracker* tracker, uint32_t initialTsn);
+// Returns 0 if the TSN was already received or is too old to tell.
+int32_t SctpTsnTrackerAdd(SctpTsnTracker* tracker, uint32_t tsn);
+// Gives up on everything up to newCumulativeTsn (FORWARD-TSN).
+void SctpTsnTrackerForward(SctpTsnTracker* tracker, uint32_t newCumulativeTsn);
+// Writes start and end offset pairs of the received runs in the window,
+// returns the number of blocks.
+int32_t SctpTsnTrackerGapBlocks(const SctpTsnTracker* tracker,
+                                uint16_t* blocks, int32_t maxBlocks);
+
 struct SctpPacket {
   uint16_t sourcePort;
   uint16_t destionationPort;
@@ -93,8 +124,16 @@ struct SctpPacket {
 int32_t ParseSctpPacket(const uint8_t* buf, size_t len, SctpPacket* packet,
                         SctpChunk* chunks, size_t maxChunks, size_t* nChunk);
 
+// Returns the packet length, or 0 when the chunks don't fit dstLen.
 size_t SerializeSctpPacket(const SctpPacket* packet, const SctpChunk* chunks,
                            size_t numChunks, uint8_t* dst, size_t dstLen);
+// Bytes SerializeSctpPacket writes for a chunk, padding included.
+size_t SctpSerializedChunkLength(const SctpChunk* chunk);
+// Rewrites the destination port, verification tag and TSN of a serialized
+// packet holding a single DATA chunk, and its checksum.
+void SctpPatchDataPacket(uint8_t* packet, size_t length,
+                         uint16_t destinationPort, uint32_t verificationTag,
+                         uint32_t tsn);
 
 int32_t SctpDataChunkLength(int32_t userDataLength);
 int32_t SctpChunkLength(int32_t contentLength);
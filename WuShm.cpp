@@ -0,0 +1,614 @@
+#include "WuShm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include "WuAlloc.h"
+#include "WuClock.h"
+
+const uint32_t kShmMagic = 0x57755348;
+const uint32_t kShmVersion = 1;
+const int32_t kMinShmSlots = 16;
+const int32_t kMaxShmSlots = 1 << 15;
+const int32_t kSlotIndexBits = 16;
+const int32_t kSlotIndexMask = (1 << kSlotIndexBits) - 1;
+const int32_t kSlotGenerationMask = (1 << 15) - 1;
+const int32_t kShmDetached = -1;
+const double kLivenessInterval = 1.0;
+
+enum WuShmRingIndex {
+  WuShmRing_Events,
+  WuShmRing_EventFree,
+  WuShmRing_Commands,
+  WuShmRing_SendFree,
+  WuShmRing_Count
+};
+
+// Each ring has one producer and one consumer. Events and SendFree are
+// produced by the daemon, EventFree and Commands by the application. The
+// free rings carry slot indices back to the side that fills them next.
+struct WuShmRing {
+  std::atomic<uint32_t> head;
+  uint8_t pad0[60];
+  std::atomic<uint32_t> tail;
+  uint8_t pad1[60];
+};
+
+struct WuShmEntry {
+  int32_t type;
+  uint32_t clientId;
+  int32_t slot;
+  int32_t length;
+};
+
+// Start of the region, followed by the entries of every ring and then the
+// slots. Event slots are [0, numSlots), send slots [numSlots, 2 * numSlots).
+struct WuShmHeader {
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  uint32_t numSlots;
+  uint32_t ringCapacity;
+  uint64_t size;
+  std::atomic<int32_t> appPid;
+  uint8_t pad[36];
+  WuShmRing rings[WuShmRing_Count];
+};
+
+struct WuShmClient {
+  uint32_t id;
+  WuClient* client;
+};
+
+// The daemon's record of a slot. A slot goes to the application as a handle
+// holding its index and generation, and the daemon takes back only the
+// handle of the current generation, once.
+struct WuShmSlotState {
+  uint16_t generation;
+  bool app;
+};
+
+struct WuShm {
+  WuAllocator allocator;
+  WuShmHeader* header;
+  WuShmEntry* entries[WuShmRing_Count];
+  uint8_t* slots;
+  size_t size;
+  char name[256];
+
+  // Daemon only.
+  int32_t attachedPid;
+  double lastLivenessCheck;
+  WuShmClient* clients;
+  uint32_t clientsMask;
+  WuShmSlotState* slotStates;
+  WuShmStats stats;
+};
+
+static size_t Align64(size_t n) { return (n + 63) & ~size_t(63); }
+
+static size_t RegionSize(uint32_t numSlots, uint32_t ringCapacity) {
+  return Align64(sizeof(WuShmHeader)) +
+         Align64(WuShmRing_Count * ringCapacity * sizeof(WuShmEntry)) +
+         size_t(2) * numSlots * kWuShmSlotSize;
+}
+
+static void MapRegion(WuShm* shm, uint8_t* base) {
+  shm->header = (WuShmHeader*)base;
+  const uint32_t capacity = shm->header->ringCapacity;
+  uint8_t* entries = base + Align64(sizeof(WuShmHeader));
+  for (int32_t i = 0; i < WuShmRing_Count; i++) {
+    shm->entries[i] = (WuShmEntry*)entries + i * capacity;
+  }
+  shm->slots =
+      entries + Align64(WuShmRing_Count * capacity * sizeof(WuShmEntry));
+}
+
+static bool RingPush(WuShm* shm, WuShmRingIndex index,
+                     const WuShmEntry* entry) {
+  WuShmRing* ring = &shm->header->rings[index];
+  const uint32_t capacity = shm->header->ringCapacity;
+  const uint32_t head = ring->head.load(std::memory_order_relaxed);
+  if (head - ring->tail.load(std::memory_order_acquire) == capacity) {
+    return false;
+  }
+
+  shm->entries[index][head & (capacity - 1)] = *entry;
+  ring->head.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+static bool RingPop(WuShm* shm, WuShmRingIndex index, WuShmEntry* entry) {
+  WuShmRing* ring = &shm->header->rings[index];
+  const uint32_t capacity = shm->header->ringCapacity;
+  const uint32_t tail = ring->tail.load(std::memory_order_relaxed);
+  if (tail == ring->head.load(std::memory_order_acquire)) {
+    return false;
+  }
+
+  *entry = shm->entries[index][tail & (capacity - 1)];
+  ring->tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+static bool RingFull(WuShm* shm, WuShmRingIndex index) {
+  WuShmRing* ring = &shm->header->rings[index];
+  return ring->head.load(std::memory_order_relaxed) -
+             ring->tail.load(std::memory_order_acquire) ==
+         shm->header->ringCapacity;
+}
+
+static int32_t SlotIndex(int32_t handle) { return handle & kSlotIndexMask; }
+
+static uint8_t* SlotData(WuShm* shm, int32_t handle) {
+  return shm->slots + size_t(SlotIndex(handle)) * kWuShmSlotSize;
+}
+
+// Daemon only. Gives a slot to the application under a new generation.
+static int32_t GiveSlot(WuShm* shm, int32_t slot) {
+  WuShmSlotState* state = &shm->slotStates[slot];
+  state->generation = uint16_t((state->generation + 1) & kSlotGenerationMask);
+  state->app = true;
+  return slot | (int32_t(state->generation) << kSlotIndexBits);
+}
+
+// Daemon only. Takes a slot in [first, end) back from the application,
+// failing for handles that are out of range, stale or already returned.
+static bool TakeSlot(WuShm* shm, int32_t handle, int32_t first, int32_t end) {
+  const int32_t slot = SlotIndex(handle);
+  if (handle < 0 || slot < first || slot >= end) {
+    return false;
+  }
+
+  WuShmSlotState* state = &shm->slotStates[slot];
+  if (!state->app ||
+      state->generation != uint16_t(handle >> kSlotIndexBits)) {
+    return false;
+  }
+
+  state->app = false;
+  return true;
+}
+
+static uint32_t ClientHash(uint32_t id) { return id * 2654435761u; }
+
+static WuShmClient* FindClient(WuShm* shm, uint32_t id) {
+  uint32_t i = ClientHash(id) & shm->clientsMask;
+  while (shm->clients[i].id != 0) {
+    if (shm->clients[i].id == id) {
+      return &shm->clients[i];
+    }
+    i = (i + 1) & shm->clientsMask;
+  }
+  return NULL;
+}
+
+// Fails when the table is full, which takes more clients than maxClients.
+static bool InsertClient(WuShm* shm, uint32_t id, WuClient* client) {
+  uint32_t i = ClientHash(id) & shm->clientsMask;
+  for (uint32_t probes = 0; probes <= shm->clientsMask; probes++) {
+    if (shm->clients[i].id == 0 || shm->clients[i].id == id) {
+      shm->clients[i].id = id;
+      shm->clients[i].client = client;
+      return true;
+    }
+    i = (i + 1) & shm->clientsMask;
+  }
+  return false;
+}
+
+static void RemoveClient(WuShm* shm, uint32_t id) {
+  WuShmClient* entry = FindClient(shm, id);
+  if (!entry) {
+    return;
+  }
+
+  // Backward shift, entries after the hole move up unless that would put
+  // them before their home position.
+  const uint32_t mask = shm->clientsMask;
+  uint32_t hole = uint32_t(entry - shm->clients);
+  uint32_t i = hole;
+  for (;;) {
+    i = (i + 1) & mask;
+    if (shm->clients[i].id == 0) {
+      break;
+    }
+
+    const uint32_t home = ClientHash(shm->clients[i].id) & mask;
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      shm->clients[hole] = shm->clients[i];
+      hole = i;
+    }
+  }
+  shm->clients[hole].id = 0;
+  shm->clients[hole].client = NULL;
+}
+
+// Daemon only, while no application can touch the rings.
+static void ResetRings(WuShm* shm) {
+  WuShmHeader* header = shm->header;
+  for (int32_t i = 0; i < WuShmRing_Count; i++) {
+    header->rings[i].head.store(0, std::memory_order_relaxed);
+    header->rings[i].tail.store(0, std::memory_order_relaxed);
+  }
+
+  const int32_t numSlots = int32_t(header->numSlots);
+  for (int32_t i = 0; i < numSlots; i++) {
+    WuShmEntry entry = {0, 0, GiveSlot(shm, i), 0};
+    RingPush(shm, WuShmRing_EventFree, &entry);
+    entry.slot = GiveSlot(shm, numSlots + i);
+    RingPush(shm, WuShmRing_SendFree, &entry);
+  }
+}
+
+static void Reset(WuShm* shm) {
+  ResetRings(shm);
+  shm->attachedPid = 0;
+  shm->stats.resets++;
+  shm->header->appPid.store(0, std::memory_order_release);
+}
+
+static void PushJoins(WuShm* shm) {
+  for (uint32_t i = 0; i <= shm->clientsMask; i++) {
+    if (shm->clients[i].id == 0) {
+      continue;
+    }
+
+    WuShmEntry entry = {WuEvent_ClientJoin, shm->clients[i].id, -1, 0};
+    if (!RingPush(shm, WuShmRing_Events, &entry)) {
+      shm->stats.droppedEvents++;
+    }
+  }
+}
+
+WuShm* WuShmCreate(const WuConf* conf, const char* name, int32_t numSlots) {
+  if (strlen(name) >= sizeof(WuShm::name)) {
+    return NULL;
+  }
+
+  if (numSlots < kMinShmSlots) {
+    numSlots = kMinShmSlots;
+  } else if (numSlots > kMaxShmSlots) {
+    numSlots = kMaxShmSlots;
+  }
+
+  // Room for an event in every slot, the joins replayed to an application
+  // that attaches with every client connected, and as many other events.
+  const int32_t maxClients = WuConfMaxClients(conf);
+  uint32_t ringCapacity = 1;
+  while (ringCapacity < uint32_t(2 * numSlots + maxClients)) {
+    ringCapacity <<= 1;
+  }
+
+  uint32_t clientsCapacity = 1;
+  while (clientsCapacity < uint32_t(2 * maxClients)) {
+    clientsCapacity <<= 1;
+  }
+
+  WuShm* shm = (WuShm*)WuCalloc(&conf->allocator, 1, sizeof(WuShm));
+  if (!shm) {
+    return NULL;
+  }
+
+  shm->allocator = conf->allocator;
+  shm->clients = (WuShmClient*)WuCalloc(&conf->allocator, clientsCapacity,
+                                        sizeof(WuShmClient));
+  shm->slotStates = (WuShmSlotState*)WuCalloc(
+      &conf->allocator, size_t(2 * numSlots), sizeof(WuShmSlotState));
+  if (!shm->clients || !shm->slotStates) {
+    WuFree(&conf->allocator, shm->clients);
+    WuFree(&conf->allocator, shm->slotStates);
+    WuFree(&conf->allocator, shm);
+    return NULL;
+  }
+  shm->clientsMask = clientsCapacity - 1;
+
+  // A region left behind by a daemon that crashed has no clients anymore.
+  shm_unlink(name);
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  const size_t size = RegionSize(uint32_t(numSlots), ringCapacity);
+  void* base = MAP_FAILED;
+  if (fd != -1 && ftruncate(fd, off_t(size)) == 0) {
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+
+  if (fd != -1) {
+    close(fd);
+  }
+
+  if (base == MAP_FAILED) {
+    shm_unlink(name);
+    WuFree(&conf->allocator, shm->clients);
+    WuFree(&conf->allocator, shm->slotStates);
+    WuFree(&conf->allocator, shm);
+    return NULL;
+  }
+
+  strcpy(shm->name, name);
+  shm->size = size;
+
+  WuShmHeader* header = (WuShmHeader*)base;
+  header->version = kShmVersion;
+  header->numSlots = uint32_t(numSlots);
+  header->ringCapacity = ringCapacity;
+  header->size = size;
+  MapRegion(shm, (uint8_t*)base);
+  ResetRings(shm);
+  header->appPid.store(0, std::memory_order_relaxed);
+  header->magic.store(kShmMagic, std::memory_order_release);
+
+  shm->lastLivenessCheck = MsNow() * 0.001;
+  return shm;
+}
+
+void WuShmDestroy(WuShm* shm) {
+  const WuAllocator allocator = shm->allocator;
+  munmap(shm->header, shm->size);
+  shm_unlink(shm->name);
+  WuFree(&allocator, shm->clients);
+  WuFree(&allocator, shm->slotStates);
+  WuFree(&allocator, shm);
+}
+
+void WuShmUpdate(WuShm* shm) {
+  const int32_t pid = shm->header->appPid.load(std::memory_order_acquire);
+  if (pid == kShmDetached) {
+    Reset(shm);
+    return;
+  }
+
+  if (pid == 0) {
+    return;
+  }
+
+  if (pid != shm->attachedPid) {
+    shm->attachedPid = pid;
+    PushJoins(shm);
+    return;
+  }
+
+  const double now = MsNow() * 0.001;
+  if (now - shm->lastLivenessCheck < kLivenessInterval) {
+    return;
+  }
+
+  shm->lastLivenessCheck = now;
+  if (kill(pid, 0) == -1 && errno == ESRCH) {
+    Reset(shm);
+  }
+}
+
+int32_t WuShmPushEvent(WuShm* shm, const WuEvent* evt) {
+  const uint32_t id = WuClientGetId(evt->client);
+  if (evt->type == WuEvent_ClientJoin) {
+    if (!InsertClient(shm, id, evt->client)) {
+      shm->stats.droppedEvents++;
+      return 0;
+    }
+  } else if (evt->type == WuEvent_ClientLeave) {
+    RemoveClient(shm, id);
+  }
+
+  if (shm->attachedPid == 0) {
+    return 0;
+  }
+
+  // Only data events set length.
+  const bool hasData = (evt->type == WuEvent_TextData ||
+                        evt->type == WuEvent_BinaryData) &&
+                       evt->length > 0;
+  WuShmEntry entry = {evt->type, id, -1, 0};
+  if (RingFull(shm, WuShmRing_Events) ||
+      (hasData && evt->length > kWuShmSlotSize)) {
+    shm->stats.droppedEvents++;
+    return 0;
+  }
+
+  if (hasData) {
+    const int32_t numSlots = int32_t(shm->header->numSlots);
+    WuShmEntry released;
+    for (;;) {
+      if (!RingPop(shm, WuShmRing_EventFree, &released)) {
+        shm->stats.droppedEvents++;
+        return 0;
+      }
+
+      if (TakeSlot(shm, released.slot, 0, numSlots)) {
+        break;
+      }
+      shm->stats.badEntries++;
+    }
+
+    entry.slot = GiveSlot(shm, SlotIndex(released.slot));
+    entry.length = evt->length;
+    memcpy(SlotData(shm, entry.slot), evt->data, size_t(evt->length));
+  }
+
+  RingPush(shm, WuShmRing_Events, &entry);
+  return 1;
+}
+
+static void ReturnSendSlot(WuShm* shm, int32_t slot) {
+  WuShmEntry entry = {0, 0, GiveSlot(shm, slot), 0};
+  RingPush(shm, WuShmRing_SendFree, &entry);
+}
+
+static bool TakeSendSlot(WuShm* shm, int32_t handle) {
+  const int32_t numSlots = int32_t(shm->header->numSlots);
+  if (TakeSlot(shm, handle, numSlots, 2 * numSlots)) {
+    return true;
+  }
+
+  shm->stats.badEntries++;
+  return false;
+}
+
+int32_t WuShmPollCommand(WuShm* shm, WuShmCommand* cmd) {
+  if (shm->attachedPid == 0) {
+    return 0;
+  }
+
+  WuShmEntry entry;
+  while (RingPop(shm, WuShmRing_Commands, &entry)) {
+    if (entry.type == WuShmCommand_ReleaseBuffer) {
+      if (TakeSendSlot(shm, entry.slot)) {
+        ReturnSendSlot(shm, SlotIndex(entry.slot));
+      }
+      continue;
+    }
+
+    const bool send = entry.type == WuShmCommand_SendText ||
+                      entry.type == WuShmCommand_SendBinary;
+    if (send && !TakeSendSlot(shm, entry.slot)) {
+      continue;
+    }
+
+    const bool valid =
+        send ? entry.length >= 0 && entry.length <= kWuShmSlotSize
+             : entry.type == WuShmCommand_RemoveClient;
+    WuShmClient* client = valid ? FindClient(shm, entry.clientId) : NULL;
+
+    if (!client) {
+      shm->stats.droppedCommands++;
+      if (send) {
+        ReturnSendSlot(shm, SlotIndex(entry.slot));
+      }
+      continue;
+    }
+
+    cmd->type = WuShmCommandType(entry.type);
+    cmd->client = client->client;
+    cmd->clientId = entry.clientId;
+    cmd->data = send ? SlotData(shm, entry.slot) : NULL;
+    cmd->length = send ? entry.length : 0;
+    cmd->slot = send ? SlotIndex(entry.slot) : -1;
+
+    if (cmd->type == WuShmCommand_RemoveClient) {
+      RemoveClient(shm, entry.clientId);
+    }
+
+    return 1;
+  }
+
+  return 0;
+}
+
+void WuShmReleaseCommand(WuShm* shm, const WuShmCommand* cmd) {
+  if (cmd->slot >= 0 && !shm->slotStates[cmd->slot].app) {
+    ReturnSendSlot(shm, cmd->slot);
+  }
+}
+
+void WuShmGetStats(const WuShm* shm, WuShmStats* stats) {
+  *stats = shm->stats;
+}
+
+WuShm* WuShmAttach(const char* name) {
+  WuAllocator allocator;
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd == -1) {
+    return NULL;
+  }
+
+  struct stat st;
+  void* base = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && size_t(st.st_size) > sizeof(WuShmHeader)) {
+    base = mmap(NULL, size_t(st.st_size), PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0);
+  }
+  close(fd);
+
+  if (base == MAP_FAILED) {
+    return NULL;
+  }
+
+  const size_t size = size_t(st.st_size);
+  WuShmHeader* header = (WuShmHeader*)base;
+  int32_t expected = 0;
+  if (header->magic.load(std::memory_order_acquire) != kShmMagic ||
+      header->version != kShmVersion || header->size != size ||
+      RegionSize(header->numSlots, header->ringCapacity) != size ||
+      !header->appPid.compare_exchange_strong(expected, int32_t(getpid()),
+                                              std::memory_order_acq_rel)) {
+    munmap(base, size);
+    return NULL;
+  }
+
+  WuShm* shm = (WuShm*)WuCalloc(&allocator, 1, sizeof(WuShm));
+  if (!shm) {
+    header->appPid.store(kShmDetached, std::memory_order_release);
+    munmap(base, size);
+    return NULL;
+  }
+
+  shm->allocator = allocator;
+  shm->size = size;
+  MapRegion(shm, (uint8_t*)base);
+  return shm;
+}
+
+void WuShmDetach(WuShm* shm) {
+  const WuAllocator allocator = shm->allocator;
+  shm->header->appPid.store(kShmDetached, std::memory_order_release);
+  munmap(shm->header, shm->size);
+  WuFree(&allocator, shm);
+}
+
+int32_t WuShmPoll(WuShm* shm, WuShmEvent* evt) {
+  WuShmEntry entry;
+  if (!RingPop(shm, WuShmRing_Events, &entry)) {
+    return 0;
+  }
+
+  evt->type = WuEventType(entry.type);
+  evt->clientId = entry.clientId;
+  evt->data = entry.slot >= 0 ? SlotData(shm, entry.slot) : NULL;
+  evt->length = entry.length;
+  evt->slot = entry.slot;
+  return 1;
+}
+
+void WuShmReleaseEvent(WuShm* shm, const WuShmEvent* evt) {
+  if (evt->slot >= 0) {
+    WuShmEntry entry = {0, 0, evt->slot, 0};
+    RingPush(shm, WuShmRing_EventFree, &entry);
+  }
+}
+
+uint8_t* WuShmAcquireBuffer(WuShm* shm, int32_t* slot) {
+  WuShmEntry entry;
+  if (!RingPop(shm, WuShmRing_SendFree, &entry)) {
+    return NULL;
+  }
+
+  *slot = entry.slot;
+  return SlotData(shm, entry.slot);
+}
+
+void WuShmReleaseBuffer(WuShm* shm, int32_t slot) {
+  WuShmEntry entry = {WuShmCommand_ReleaseBuffer, 0, slot, 0};
+  RingPush(shm, WuShmRing_Commands, &entry);
+}
+
+static int32_t PushCommand(WuShm* shm, WuShmCommandType type,
+                           uint32_t clientId, int32_t slot, int32_t length) {
+  WuShmEntry entry = {type, clientId, slot, length};
+  return RingPush(shm, WuShmRing_Commands, &entry) ? 1 : 0;
+}
+
+int32_t WuShmSendText(WuShm* shm, uint32_t clientId, int32_t slot,
+                      int32_t length) {
+  return PushCommand(shm, WuShmCommand_SendText, clientId, slot, length);
+}
+
+int32_t WuShmSendBinary(WuShm* shm, uint32_t clientId, int32_t slot,
+                        int32_t length) {
+  return PushCommand(shm, WuShmCommand_SendBinary, clientId, slot, length);
+}
+
+int32_t WuShmRemoveClient(WuShm* shm, uint32_t clientId) {
+  return PushCommand(shm, WuShmCommand_RemoveClient, clientId, -1, 0);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include "Wu.h"
+
+// Runs Wu in a daemon process and hands events and sends to one application
+// process through single-producer single-consumer rings in a shared memory
+// region. Payloads live in fixed size slots of the same region: the daemon
+// writes received messages into event slots the application reads in place,
+// and the application fills send slots the daemon sends from directly. Only
+// slot indices go through the rings, and clients are named by WuClientGetId
+// since pointers don't cross the process boundary.
+//
+// The daemon outlives the application. When the attached process exits or
+// detaches, the daemon takes back every slot, and the next application to
+// attach gets a WuEvent_ClientJoin for each client still connected.
+
+const int32_t kWuShmSlotSize = 4096;
+
+struct WuShm;
+
+enum WuShmCommandType {
+  WuShmCommand_SendText,
+  WuShmCommand_SendBinary,
+  WuShmCommand_RemoveClient,
+  WuShmCommand_ReleaseBuffer
+};
+
+struct WuShmEvent {
+  WuEventType type;
+  uint32_t clientId;
+  const uint8_t* data;
+  int32_t length;
+  int32_t slot;
+};
+
+struct WuShmCommand {
+  WuShmCommandType type;
+  WuClient* client;
+  uint32_t clientId;
+  const uint8_t* data;
+  int32_t length;
+  int32_t slot;
+};
+
+struct WuShmStats {
+  uint64_t droppedEvents;
+  uint64_t droppedCommands;
+  uint64_t resets;
+  // Slots handed back by the application that were out of range, stale or
+  // already returned, and were ignored.
+  uint64_t badEntries;
+};
+
+// Daemon side. Creates the shared memory object name ("/webudp", as for
+// shm_open) with numSlots event slots and as many send slots, at most 32768.
+// Call WuShmUpdate once per loop iteration, forward every WuEvent with
+// WuShmPushEvent, then run what WuShmPollCommand returns and hand each
+// command back with WuShmReleaseCommand.
+WuShm* WuShmCreate(const WuConf* conf, const char* name, int32_t numSlots);
+void WuShmDestroy(WuShm* shm);
+void WuShmUpdate(WuShm* shm);
+int32_t WuShmPushEvent(WuShm* shm, const WuEvent* evt);
+int32_t WuShmPollCommand(WuShm* shm, WuShmCommand* cmd);
+void WuShmReleaseCommand(WuShm* shm, const WuShmCommand* cmd);
+void WuShmGetStats(const WuShm* shm, WuShmStats* stats);
+
+// Application side. Only one process can be attached at a time. Events with
+// a payload point into an event slot until WuShmReleaseEvent. Buffers from
+// WuShmAcquireBuffer hold kWuShmSlotSize bytes and are handed back by
+// sending them or with WuShmReleaseBuffer.
+WuShm* WuShmAttach(const char* name);
+void WuShmDetach(WuShm* shm);
+int32_t WuShmPoll(WuShm* shm, WuShmEvent* evt);
+void WuShmReleaseEvent(WuShm* shm, const WuShmEvent* evt);
+uint8_t* WuShmAcquireBuffer(WuShm* shm, int32_t* slot);
+void WuShmReleaseBuffer(WuShm* shm, int32_t slot);
+int32_t WuShmSendText(WuShm* shm, uint32_t clientId, int32_t slot,
+                      int32_t length);
+int32_t WuShmSendBinary(WuShm* shm, uint32_t clientId, int32_t slot,
+                        int32_t length);
+int32_t WuShmRemoveClient(WuShm* shm, uint32_t clientId);
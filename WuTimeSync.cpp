@@ -0,0 +1,51 @@
+#include "WuTimeSync.h"
+#include <string.h>
+#include "WuBufferOp.h"
+
+const uint8_t kTimeSyncMagic[4] = {'W', 'u', 'T', 'S'};
+const uint8_t kTimeSyncVersion = 1;
+
+static int32_t ReadTimestamp(const uint8_t* src, double* v) {
+  uint64_t bits;
+  int32_t n = ReadScalarSwapped(src, &bits);
+  memcpy(v, &bits, sizeof(bits));
+  return n;
+}
+
+static int32_t WriteTimestamp(uint8_t* dst, double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  return int32_t(WriteScalarSwapped(dst, bits));
+}
+
+bool ParseTimeSyncPacket(const uint8_t* buf, int32_t len,
+                         TimeSyncPacket* packet) {
+  if (len != kTimeSyncPacketLength ||
+      memcmp(buf, kTimeSyncMagic, sizeof(kTimeSyncMagic)) != 0 ||
+      buf[4] != kTimeSyncVersion) {
+    return false;
+  }
+
+  int32_t offset = 8;
+  offset += ReadTimestamp(buf + offset, &packet->origin);
+  offset += ReadTimestamp(buf + offset, &packet->receive);
+  ReadTimestamp(buf + offset, &packet->transmit);
+  return true;
+}
+
+int32_t SerializeTimeSyncPacket(const TimeSyncPacket* packet, uint8_t* dst,
+                                int32_t dstLen) {
+  if (dstLen < kTimeSyncPacketLength) {
+    return 0;
+  }
+
+  memcpy(dst, kTimeSyncMagic, sizeof(kTimeSyncMagic));
+  memset(dst + 4, 0, 4);
+  dst[4] = kTimeSyncVersion;
+
+  int32_t offset = 8;
+  offset += WriteTimestamp(dst + offset, packet->origin);
+  offset += WriteTimestamp(dst + offset, packet->receive);
+  offset += WriteTimestamp(dst + offset, packet->transmit);
+  return offset;
+}
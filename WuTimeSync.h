@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdint.h>
+
+// NTP style clock synchronization over binary data channel messages. Both
+// directions carry the same packet: the transmit time of the last packet
+// received from the other side (origin), the local time it arrived at
+// (receive) and the local time this one is sent at (transmit), seconds on
+// the sender's monotonic clock. Each side completes a four timestamp
+// exchange whenever a packet echoes its own last transmit time as origin.
+//
+//   0      4        8          16          24           32
+//   | WuTS | 1 0 0 0 | origin   | receive   | transmit   |
+//
+// Timestamps are big endian IEEE 754 doubles.
+
+const int32_t kTimeSyncPacketLength = 32;
+
+struct TimeSyncPacket {
+  double origin;
+  double receive;
+  double transmit;
+};
+
+bool ParseTimeSyncPacket(const uint8_t* buf, int32_t len,
+                         TimeSyncPacket* packet);
+int32_t SerializeTimeSyncPacket(const TimeSyncPacket* packet, uint8_t* dst,
+                                int32_t dstLen);
@@ -0,0 +1,60 @@
+#include "WuTopic.h"
+#include "WuAlloc.h"
+
+const int32_t kInitialTopicCapacity = 16;
+
+WuTopic* WuTopicCreate(const WuAllocator* allocator) {
+  WuTopic* topic = (WuTopic*)WuCalloc(allocator, 1, sizeof(WuTopic));
+  if (topic) {
+    topic->allocator = *allocator;
+  }
+  return topic;
+}
+
+void WuTopicDestroy(WuTopic* topic) {
+  const WuAllocator allocator = topic->allocator;
+  WuFree(&allocator, topic->members);
+  WuFree(&allocator, topic);
+}
+
+int32_t WuTopicFind(const WuTopic* topic, const WuClient* client) {
+  for (int32_t i = 0; i < topic->numMembers; i++) {
+    if (topic->members[i] == client) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+int32_t WuTopicAdd(WuTopic* topic, WuClient* client) {
+  if (topic->numMembers == topic->capacity) {
+    const int32_t capacity =
+        topic->capacity ? topic->capacity * 2 : kInitialTopicCapacity;
+    WuClient** members = (WuClient**)WuRealloc(
+        &topic->allocator, topic->members, capacity * sizeof(WuClient*));
+    if (!members) {
+      return 0;
+    }
+
+    topic->members = members;
+    topic->capacity = capacity;
+  }
+
+  topic->members[topic->numMembers++] = client;
+  return 1;
+}
+
+int32_t WuTopicRemove(WuTopic* topic, const WuClient* client) {
+  const int32_t i = WuTopicFind(topic, client);
+  if (i < 0) {
+    return 0;
+  }
+
+  topic->members[i] = topic->members[--topic->numMembers];
+  return 1;
+}
+
+size_t WuTopicBytes(const WuTopic* topic) {
+  return sizeof(WuTopic) + size_t(topic->capacity) * sizeof(WuClient*);
+}
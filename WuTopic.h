@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+#include "Wu.h"
+
+// Members are kept in a dense, unordered array that WuPublish walks
+// straight through. Removal moves the last member into the hole.
+struct WuTopic {
+  WuAllocator allocator;
+  WuClient** members;
+  int32_t numMembers;
+  int32_t capacity;
+
+  // Position in Wu::topics.
+  int32_t index;
+};
+
+WuTopic* WuTopicCreate(const WuAllocator* allocator);
+void WuTopicDestroy(WuTopic* topic);
+int32_t WuTopicFind(const WuTopic* topic, const WuClient* client);
+int32_t WuTopicAdd(WuTopic* topic, WuClient* client);
+int32_t WuTopicRemove(WuTopic* topic, const WuClient* client);
+size_t WuTopicBytes(const WuTopic* topic);
@@ -0,0 +1,16 @@
+#pragma once
+
+// Static tracepoints in the "webudp" provider for perf and bpftrace, see
+// tools/bpftrace. Built only with -DWITH_USDT=ON; an unattached probe is a
+// single nop. Clients are identified by their WuClient address.
+
+#ifdef WU_WITH_USDT
+#include <sys/sdt.h>
+#define WU_TRACE1(name, a) DTRACE_PROBE1(webudp, name, a)
+#define WU_TRACE2(name, a, b) DTRACE_PROBE2(webudp, name, a, b)
+#define WU_TRACE3(name, a, b, c) DTRACE_PROBE3(webudp, name, a, b, c)
+#else
+#define WU_TRACE1(name, a)
+#define WU_TRACE2(name, a, b)
+#define WU_TRACE3(name, a, b, c)
+#endif
@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "../WuShm.h"
+
+// EchoServer as an application process of WuDaemon. Restarting it keeps the
+// clients connected, they're announced again with WuEvent_ClientJoin.
+
+int main() {
+  WuShm* shm = WuShmAttach("/webudp");
+  if (!shm) {
+    printf("can't attach, is WuDaemon running?\n");
+    return 1;
+  }
+
+  for (;;) {
+    WuShmEvent evt;
+    if (!WuShmPoll(shm, &evt)) {
+      usleep(100);
+      continue;
+    }
+
+    switch (evt.type) {
+      case WuEvent_ClientJoin: {
+        printf("ShmEchoServer: client %u join\n", evt.clientId);
+        break;
+      }
+      case WuEvent_ClientLeave: {
+        printf("ShmEchoServer: client %u leave\n", evt.clientId);
+        break;
+      }
+      case WuEvent_TextData: {
+        int32_t slot;
+        uint8_t* buffer = WuShmAcquireBuffer(shm, &slot);
+        if (buffer) {
+          memcpy(buffer, evt.data, evt.length);
+          if (!WuShmSendText(shm, evt.clientId, slot, evt.length)) {
+            WuShmReleaseBuffer(shm, slot);
+          }
+        }
+        break;
+      }
+      default:
+        break;
+    }
+
+    WuShmReleaseEvent(shm, &evt);
+  }
+
+  return 0;
+}
@@ -0,0 +1,78 @@
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../WuHost.h"
+#include "../WuShm.h"
+
+// Runs the epoll host and serves one application process at a time through
+// the shared memory region /webudp, see ShmEchoServer. With a cpu argument
+// the daemon is pinned to that core, away from the simulation threads.
+
+const int32_t kNumSlots = 4096;
+
+int main(int argc, char** argv) {
+  WuConf conf;
+
+  if (argc > 2) {
+    conf.host = argv[1];
+    conf.port = argv[2];
+  }
+
+  if (argc > 3) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(atoi(argv[3]), &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+      printf("can't pin to cpu %s\n", argv[3]);
+    }
+  }
+
+  WuHost* host = WuHostCreate(&conf);
+  if (!host) {
+    printf("init fail\n");
+    return 1;
+  }
+
+  WuShm* shm = WuShmCreate(&conf, "/webudp", kNumSlots);
+  if (!shm) {
+    printf("shared memory init fail\n");
+    return 1;
+  }
+
+  WuHostSetErrorCallback(host, [](const char* err, void*) {
+    printf("error: %s\n", err);
+  });
+
+  for (;;) {
+    WuShmUpdate(shm);
+
+    WuEvent evt;
+    while (WuHostServe(host, &evt)) {
+      WuShmPushEvent(shm, &evt);
+      if (evt.type == WuEvent_ClientLeave) {
+        WuHostRemoveClient(host, evt.client);
+      }
+    }
+
+    WuShmCommand cmd;
+    while (WuShmPollCommand(shm, &cmd)) {
+      switch (cmd.type) {
+        case WuShmCommand_SendText:
+          WuHostSendText(host, cmd.client, (const char*)cmd.data, cmd.length);
+          break;
+        case WuShmCommand_SendBinary:
+          WuHostSendBinary(host, cmd.client, cmd.data, cmd.length);
+          break;
+        case WuShmCommand_RemoveClient:
+          WuHostRemoveClient(host, cmd.client);
+          break;
+        default:
+          break;
+      }
+      WuShmReleaseCommand(shm, &cmd);
+    }
+  }
+
+  return 0;
+}
@@ -4,9 +4,97 @@ var WuSocket = function(address) {
   this.onmessage = null;
   this.onopen = null;
   this.open = false;
+  // Server clock minus local clock and round trip in seconds, from the time
+  // sync exchanges of a server with WuConf::timeSync.
+  this.clockOffset = 0;
+  this.rtt = 0;
+  this.timeSyncSamples = 0;
+  this.timeSyncSentAt = 0;
+  this.lastServerTransmit = 0;
+  this.lastServerReceivedAt = 0;
   this.beginConnection();
 };
 
+var kTimeSyncLength = 32;
+var kTimeSyncMagic = [0x57, 0x75, 0x54, 0x53];
+
+function isTimeSyncPacket(data) {
+  if (!(data instanceof ArrayBuffer) || data.byteLength != kTimeSyncLength) {
+    return false;
+  }
+  var bytes = new Uint8Array(data, 0, 5);
+  return bytes[0] == kTimeSyncMagic[0] && bytes[1] == kTimeSyncMagic[1] &&
+    bytes[2] == kTimeSyncMagic[2] && bytes[3] == kTimeSyncMagic[3] &&
+    bytes[4] == 1;
+}
+
+WuSocket.prototype.now = function() {
+  return performance.now() / 1000;
+};
+
+WuSocket.prototype.serverTime = function() {
+  return this.now() + this.clockOffset;
+};
+
+WuSocket.prototype.syncTime = function() {
+  if (!this.open) {
+    return;
+  }
+
+  var buffer = new ArrayBuffer(kTimeSyncLength);
+  var view = new DataView(buffer);
+  for (var i = 0; i < kTimeSyncMagic.length; i++) {
+    view.setUint8(i, kTimeSyncMagic[i]);
+  }
+  view.setUint8(4, 1);
+  this.timeSyncSentAt = this.now();
+  view.setFloat64(8, this.lastServerTransmit);
+  view.setFloat64(16, this.lastServerReceivedAt);
+  view.setFloat64(24, this.timeSyncSentAt);
+  this.channel.send(buffer);
+};
+
+WuSocket.prototype.startTimeSync = function(intervalMs) {
+  var socket = this;
+  this.syncTime();
+  return setInterval(function() {
+    socket.syncTime();
+  }, intervalMs);
+};
+
+WuSocket.prototype.handleTimeSync = function(data) {
+  var receivedAt = this.now();
+  var view = new DataView(data);
+  var origin = view.getFloat64(8);
+  var receive = view.getFloat64(16);
+  var transmit = view.getFloat64(24);
+  this.lastServerTransmit = transmit;
+  this.lastServerReceivedAt = receivedAt;
+
+  if (origin != this.timeSyncSentAt) {
+    return;
+  }
+
+  var rtt = (receivedAt - origin) - (transmit - receive);
+  var offset = ((receive - origin) + (transmit - receivedAt)) / 2;
+  if (rtt < 0) {
+    return;
+  }
+
+  // Same filter as the server: samples far slower than the smoothed round
+  // trip only update the round trip.
+  if (this.timeSyncSamples == 0) {
+    this.clockOffset = offset;
+    this.rtt = rtt;
+  } else {
+    if (rtt <= this.rtt * 1.5) {
+      this.clockOffset += 0.125 * (offset - this.clockOffset);
+    }
+    this.rtt += 0.125 * (rtt - this.rtt);
+  }
+  this.timeSyncSamples++;
+};
+
 WuSocket.prototype.send = function(data) {
   if (this.open) {
     this.channel.send(data);
@@ -68,6 +156,11 @@ WuSocket.prototype.beginConnection = function() {
   };
 
   channel.onmessage = function(evt) {
+    if (isTimeSyncPacket(evt.data)) {
+      socket.handleTimeSync(evt.data);
+      return;
+    }
+
     if (typeof(socket.onmessage) == "function") {
       socket.onmessage(evt);
     }
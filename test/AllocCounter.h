@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Replaces the glibc allocation functions for the whole process, including
+// OpenSSL, and counts calls made while counting is enabled. Include it from
+// exactly one translation unit of a test executable.
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+}
+
+struct AllocCounter {
+  bool enabled;
+  uint64_t allocs;
+  uint64_t frees;
+};
+
+static AllocCounter allocCounter;
+
+extern "C" {
+void* malloc(size_t size) __THROW {
+  allocCounter.allocs += allocCounter.enabled;
+  return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) __THROW {
+  allocCounter.allocs += allocCounter.enabled;
+  return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) __THROW {
+  allocCounter.allocs += allocCounter.enabled;
+  return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) __THROW {
+  allocCounter.frees += allocCounter.enabled && ptr;
+  __libc_free(ptr);
+}
+}
+
+// Counts allocations for the lifetime of the scope, nests.
+struct AllocScope {
+  bool previous;
+  AllocScope(bool enable) : previous(allocCounter.enabled) {
+    allocCounter.enabled = enable;
+  }
+  ~AllocScope() { allocCounter.enabled = previous; }
+};
@@ -0,0 +1,89 @@
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../Wu.h"
+
+// Measures heap bytes held per idle client, i.e. a client that completed the
+// SDP exchange but never sent any UDP traffic. Each size runs in its own
+// process so that the measurements do not accumulate.
+
+static const char kOffer[] =
+    "v=0\r\n"
+    "o=- 0 2 IN IP4 127.0.0.1\r\n"
+    "s=-\r\n"
+    "t=0 0\r\n"
+    "m=application 9 DTLS/SCTP 5000\r\n"
+    "c=IN IP4 0.0.0.0\r\n"
+    "a=ice-ufrag:Qf3a\r\n"
+    "a=ice-pwd:5nDmCqGk0uRtwq2qYV3hFdY7\r\n"
+    "a=mid:data\r\n";
+
+static size_t HeapInUse() {
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+}
+
+static int Measure(int32_t numClients) {
+  size_t before = HeapInUse();
+
+  Wu wu;
+  WuConf conf;
+  conf.maxClients = numClients;
+
+  if (!WuInit(&wu, &conf)) {
+    return 1;
+  }
+
+  size_t empty = HeapInUse();
+
+  for (int32_t i = 0; i < numClients; i++) {
+    SDPResult res = WuExchangeSDP(&wu, kOffer, sizeof(kOffer) - 1);
+    if (res.status != WuSDPStatus_Success) {
+      printf("%d clients: exchange failed at %d\n", numClients, i);
+      return 1;
+    }
+
+    // Answers live in the arena, which is reset on every tick.
+    if (i % 256 == 0) {
+      WuEvent evt;
+      while (WuUpdate(&wu, &evt)) {
+      }
+    }
+  }
+
+  size_t full = HeapInUse();
+
+  printf("%7d clients: %8.1f bytes/client (%8.1f incl. init), %8.2f MiB\n",
+         numClients, double(full - empty) / numClients,
+         double(full - before) / numClients,
+         double(full - before) / (1024.0 * 1024.0));
+
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const int32_t defaultSizes[] = {1000, 10000, 100000};
+
+  for (int32_t i = 0; i < 3; i++) {
+    int32_t numClients = defaultSizes[i];
+    if (argc > 1) {
+      numClients = atoi(argv[1]);
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      return Measure(numClients);
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+
+    if (argc > 1) {
+      break;
+    }
+  }
+
+  return 0;
+}
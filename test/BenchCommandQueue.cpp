@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <thread>
+#include "../Wu.h"
+#include "../WuClock.h"
+#include "../WuCommandQueue.h"
+#include "Loopback.h"
+
+// Throughput of commands enqueued from 4 and 8 producer threads. The queue
+// alone is drained by a counting consumer, the end to end run drains through
+// WuUpdate into loopback peers which decrypt and SACK every message.
+
+const int32_t kNumPeers = 32;
+const int32_t kMessageSize = 64;
+const int32_t kQueueSize = 1 << 18;
+const double kDuration = 1.0;
+
+struct Producer {
+  Wu* wu;
+  WuCommandQueue* q;
+  WuClient* clients[kNumPeers];
+  uint32_t ids[kNumPeers];
+  int32_t index;
+  uint64_t pushed;
+  uint64_t full;
+  std::atomic<bool>* stop;
+};
+
+static void ProduceRaw(Producer* p) {
+  uint8_t message[kMessageSize];
+  memset(message, p->index, sizeof(message));
+  while (!p->stop->load(std::memory_order_relaxed)) {
+    if (WuCommandQueuePush(p->q, WuCommand_SendBinary, NULL, 0, message,
+                           kMessageSize)) {
+      p->pushed++;
+    } else {
+      p->full++;
+      std::this_thread::yield();
+    }
+  }
+}
+
+static void ProduceSends(Producer* p) {
+  uint8_t message[kMessageSize];
+  memset(message, p->index, sizeof(message));
+  int32_t peer = p->index % kNumPeers;
+  while (!p->stop->load(std::memory_order_relaxed)) {
+    if (WuEnqueueSendBinary(p->wu, p->clients[peer], p->ids[peer], message,
+                            kMessageSize)) {
+      p->pushed++;
+      peer = (peer + 1) % kNumPeers;
+    } else {
+      p->full++;
+      std::this_thread::yield();
+    }
+  }
+}
+
+static void Count(const WuCommand*, const uint8_t*, void* userData) {
+  (*(uint64_t*)userData)++;
+}
+
+static void RunQueue(int32_t numProducers) {
+  WuAllocator allocator;
+  WuCommandQueue* q = WuCommandQueueCreate(&allocator, kQueueSize);
+  std::atomic<bool> stop(false);
+
+  Producer producers[8];
+  std::thread threads[8];
+  for (int32_t i = 0; i < numProducers; i++) {
+    memset(&producers[i], 0, sizeof(Producer));
+    producers[i].q = q;
+    producers[i].index = i;
+    producers[i].stop = &stop;
+    threads[i] = std::thread(ProduceRaw, &producers[i]);
+  }
+
+  uint64_t drained = 0;
+  const double start = MsNow() * 0.001;
+  double now = start;
+  while (now - start < kDuration) {
+    if (!WuCommandQueueDrain(q, Count, &drained)) {
+      std::this_thread::yield();
+    }
+    now = MsNow() * 0.001;
+  }
+
+  stop.store(true);
+  uint64_t full = 0;
+  for (int32_t i = 0; i < numProducers; i++) {
+    threads[i].join();
+    full += producers[i].full;
+  }
+
+  printf("queue only, %d producers: %10.0f commands/s, %llu full\n",
+         numProducers, double(drained) / (now - start),
+         (unsigned long long)full);
+  WuCommandQueueDestroy(q);
+}
+
+static int RunWu(int32_t numProducers) {
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+  conf.commandQueueSize = kQueueSize;
+
+  if (!WuInit(&wu, &conf)) {
+    printf("WuInit failed\n");
+    return 1;
+  }
+
+  Loopback lb;
+  LoopbackInit(&lb, &wu, kNumPeers);
+  if (!LoopbackConnectAll(&lb, 200)) {
+    printf("data channels didn't open\n");
+    return 1;
+  }
+
+  std::atomic<bool> stop(false);
+  Producer producers[8];
+  std::thread threads[8];
+  for (int32_t i = 0; i < numProducers; i++) {
+    memset(&producers[i], 0, sizeof(Producer));
+    producers[i].wu = &wu;
+    producers[i].index = i;
+    producers[i].stop = &stop;
+    for (int32_t j = 0; j < kNumPeers; j++) {
+      producers[i].clients[j] = lb.peers[j].client;
+      producers[i].ids[j] = WuClientGetId(lb.peers[j].client);
+    }
+  }
+
+  int32_t receivedBefore = 0;
+  for (int32_t i = 0; i < kNumPeers; i++) {
+    receivedBefore += lb.peers[i].received;
+  }
+
+  for (int32_t i = 0; i < numProducers; i++) {
+    threads[i] = std::thread(ProduceSends, &producers[i]);
+  }
+
+  const double start = MsNow() * 0.001;
+  double now = start;
+  while (now - start < kDuration) {
+    WuEvent evt;
+    while (WuUpdate(&wu, &evt)) {
+    }
+    LoopbackPump(&lb);
+    now = MsNow() * 0.001;
+  }
+
+  stop.store(true);
+  for (int32_t i = 0; i < numProducers; i++) {
+    threads[i].join();
+  }
+
+  int32_t received = -receivedBefore;
+  for (int32_t i = 0; i < kNumPeers; i++) {
+    received += lb.peers[i].received;
+  }
+
+  printf("through Wu, %d producers: %10.0f messages/s, %llu dropped\n",
+         numProducers, double(received) / (now - start),
+         (unsigned long long)wu.stats.droppedCommands);
+
+  LoopbackDestroy(&lb);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const int32_t maxProducers = argc > 1 ? atoi(argv[1]) : 8;
+
+  int failed = 0;
+  for (int32_t n = 4; n <= maxProducers && n <= 8; n += 4) {
+    RunQueue(n);
+    failed |= RunWu(n);
+  }
+  return failed;
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "../Wu.h"
+#include "../WuClock.h"
+#include "Loopback.h"
+
+// Time to open a data channel when server DTLS handshake datagrams are
+// dropped, with and without server side retransmission timers. Peers
+// retransmit like browsers, after a second.
+
+const int32_t kNumPeers = 32;
+const double kTimeout = 30.0;
+
+static int CompareDoubles(const void* a, const void* b) {
+  const double x = *(const double*)a;
+  const double y = *(const double*)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static int Run(double lossRate, double retransmitTimeout) {
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+  conf.dtlsRetransmitTimeout = retransmitTimeout;
+
+  if (!WuInit(&wu, &conf)) {
+    printf("WuInit failed\n");
+    return 1;
+  }
+
+  Loopback lb;
+  LoopbackInit(&lb, &wu, kNumPeers);
+  lb.lossRate = lossRate;
+
+  double joinTimes[kNumPeers];
+  const double start = MsNow() * 0.001;
+
+  for (int32_t i = 0; i < kNumPeers; i++) {
+    joinTimes[i] = -1.0;
+    if (!LoopbackConnect(&lb, i)) {
+      printf("SDP exchange failed\n");
+      return 1;
+    }
+  }
+
+  int32_t numOpen = 0;
+  while (numOpen < kNumPeers && MsNow() * 0.001 - start < kTimeout) {
+    LoopbackPump(&lb);
+
+    WuEvent evt;
+    while (WuUpdate(&wu, &evt)) {
+    }
+
+    for (int32_t i = 0; i < kNumPeers; i++) {
+      if (lb.peers[i].open && joinTimes[i] < 0.0) {
+        joinTimes[i] = MsNow() * 0.001 - start;
+        numOpen++;
+      }
+    }
+
+    usleep(1000);
+  }
+
+  if (numOpen < kNumPeers) {
+    printf("only %d of %d peers connected\n", numOpen, kNumPeers);
+    return 1;
+  }
+
+  qsort(joinTimes, kNumPeers, sizeof(double), CompareDoubles);
+  printf("loss %3.0f%%, server timer %-5s: p50 %6.3f s, p90 %6.3f s, "
+         "max %6.3f s, %llu retransmits\n",
+         lossRate * 100.0, retransmitTimeout > 0.0 ? "on" : "off",
+         joinTimes[kNumPeers / 2], joinTimes[kNumPeers * 9 / 10],
+         joinTimes[kNumPeers - 1],
+         (unsigned long long)wu.stats.dtlsRetransmits);
+
+  LoopbackDestroy(&lb);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  const double lossRate = argc > 1 ? atof(argv[1]) : 0.2;
+
+  int failed = Run(0.0, 0.0);
+  failed |= Run(lossRate, 0.0);
+  failed |= Run(lossRate, 0.25);
+  return failed;
+}
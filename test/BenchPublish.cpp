@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../Wu.h"
+#include "../WuClock.h"
+#include "Loopback.h"
+
+// Publishes per second to a topic of 1000 members, against a loop of
+// WuSendBinary over the same clients. Only the sends are timed, loopback
+// peers decrypt and SACK in between.
+
+const int32_t kNumMembers = 1000;
+const int32_t kMessageSize = 100;
+const int32_t kPublishes = 512;
+const int32_t kPumpEvery = 32;
+
+static double Run(Wu* wu, Loopback* lb, WuTopic* topic, bool publish) {
+  uint8_t message[kMessageSize];
+  memset(message, 0x5a, sizeof(message));
+
+  double elapsed = 0.0;
+  for (int32_t n = 0; n < kPublishes; n++) {
+    const double start = MsNow() * 0.001;
+    if (publish) {
+      WuPublish(wu, topic, message, sizeof(message));
+    } else {
+      for (int32_t i = 0; i < lb->numPeers; i++) {
+        WuSendBinary(wu, lb->peers[i].client, message, sizeof(message));
+      }
+    }
+    elapsed += MsNow() * 0.001 - start;
+
+    if (n % kPumpEvery == kPumpEvery - 1) {
+      LoopbackPump(lb);
+      WuEvent evt;
+      while (WuUpdate(wu, &evt)) {
+      }
+    }
+  }
+
+  return elapsed;
+}
+
+int main(int argc, char** argv) {
+  const int32_t numMembers = argc > 1 ? atoi(argv[1]) : kNumMembers;
+
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+  conf.maxClients = numMembers;
+  conf.handshakeBudget = 0.0;
+
+  if (!WuInit(&wu, &conf)) {
+    printf("WuInit failed\n");
+    return 1;
+  }
+
+  Loopback lb;
+  LoopbackInit(&lb, &wu, numMembers);
+  if (!LoopbackConnectAll(&lb, 200)) {
+    printf("data channels didn't open\n");
+    return 1;
+  }
+
+  WuTopic* topic = WuCreateTopic(&wu);
+  for (int32_t i = 0; i < numMembers; i++) {
+    WuSubscribe(&wu, topic, lb.peers[i].client);
+  }
+
+  int32_t before = 0;
+  for (int32_t i = 0; i < numMembers; i++) {
+    before += lb.peers[i].received;
+  }
+
+  const double loop = Run(&wu, &lb, topic, false);
+  const double publish = Run(&wu, &lb, topic, true);
+  LoopbackPump(&lb);
+
+  int32_t received = -before;
+  for (int32_t i = 0; i < numMembers; i++) {
+    received += lb.peers[i].received;
+  }
+
+  printf("%d members, %d byte messages\n", numMembers, kMessageSize);
+  printf("WuSendBinary loop: %8.0f publishes/s, %6.0f ns per member\n",
+         kPublishes / loop, loop * 1e9 / (double(kPublishes) * numMembers));
+  printf("WuPublish:         %8.0f publishes/s, %6.0f ns per member\n",
+         kPublishes / publish,
+         publish * 1e9 / (double(kPublishes) * numMembers));
+  printf("%d of %d messages delivered\n", received,
+         2 * kPublishes * numMembers);
+
+  LoopbackDestroy(&lb);
+  return 0;
+}
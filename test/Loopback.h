@@ -0,0 +1,514 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../CRC32.h"
+#include "../Wu.h"
+#include "../WuBufferOp.h"
+#include "../WuMath.h"
+#include "../WuSctp.h"
+
+// In-process browser peers for driving a Wu instance without sockets. Each
+// peer does the SDP exchange, the STUN binding, a DTLS client handshake and
+// the SCTP and DCEP setup of a single data channel.
+
+const uint32_t kLoopbackHost = 0x7F000001;
+const uint16_t kLoopbackBasePort = 20000;
+const uint16_t kLoopbackSctpPort = 5000;
+
+struct LoopbackPeer {
+  WuClient* client;
+  WuAddress address;
+  char ufrag[16];
+  char serverUfrag[8];
+  SSL* ssl;
+  BIO* inBio;
+  BIO* outBio;
+  uint32_t tsn;
+  uint32_t verificationTag;
+  bool open;
+  // The DCEP ACK came in the same packet as the COOKIE-ACK.
+  bool openedWithCookieAck;
+  int32_t received;
+  int32_t receivedBytes;
+  // From the last SACK and FORWARD-TSN the server sent.
+  uint32_t sackTsn;
+  uint16_t sackGapBlocks;
+  uint16_t sackDupTsns;
+  uint32_t forwardTsn;
+  uint32_t lastDataTsn;
+  // HEARTBEAT-ACKs from the server and the heartbeat info bytes they echoed.
+  int32_t heartbeatAcks;
+  int32_t heartbeatAckBytes;
+  uint8_t lastMessage[1024];
+  int32_t lastMessageLength;
+  // Window advertised in the SACKs the peer sends for server DATA, none are
+  // sent while holdSacks is set.
+  uint32_t rwnd;
+  bool holdSacks;
+};
+
+struct Loopback;
+
+typedef void (*LoopbackSendFn)(Loopback* lb, LoopbackPeer* peer,
+                               const uint8_t* data, int32_t length);
+
+struct Loopback {
+  Wu* wu;
+  // Delivers peer datagrams to Wu, WuHandleUDP unless replaced.
+  LoopbackSendFn send;
+  SSL_CTX* ctx;
+  LoopbackPeer* peers;
+  int32_t numPeers;
+  // Fraction of server DTLS handshake datagrams dropped on their way to the
+  // peers. SCTP has no retransmissions in the harness, so later traffic is
+  // always delivered.
+  double lossRate;
+  uint64_t rng;
+  // Send the DCEP OPEN after the COOKIE-ACK like browsers do, instead of
+  // bundling it with the COOKIE-ECHO.
+  bool unbundledOpen;
+};
+
+static double LoopbackRandom(Loopback* lb) {
+  lb->rng ^= lb->rng << 13;
+  lb->rng ^= lb->rng >> 7;
+  lb->rng ^= lb->rng << 17;
+  return double(lb->rng % 1000000) / 1000000.0;
+}
+
+static LoopbackPeer* LoopbackFindPeer(Loopback* lb, const WuAddress* addr) {
+  int32_t i = int32_t(addr->port) - kLoopbackBasePort;
+  if (addr->host != kLoopbackHost || i < 0 || i >= lb->numPeers) {
+    return NULL;
+  }
+
+  return &lb->peers[i];
+}
+
+static void LoopbackWrite(const uint8_t* data, size_t length,
+                          const WuClient* client, void* userData) {
+  Loopback* lb = (Loopback*)userData;
+  WuAddress address = WuClientGetAddress(client);
+  LoopbackPeer* peer = LoopbackFindPeer(lb, &address);
+
+  // STUN responses carry nothing the peer needs.
+  if (!peer || length == 0 || data[0] < 20) {
+    return;
+  }
+
+  if (lb->lossRate > 0.0 && data[0] == 22 &&
+      LoopbackRandom(lb) < lb->lossRate) {
+    return;
+  }
+
+  BIO_write(peer->inBio, data, int(length));
+}
+
+inline void LoopbackInit(Loopback* lb, Wu* wu, int32_t numPeers) {
+  memset(lb, 0, sizeof(Loopback));
+  lb->wu = wu;
+  lb->rng = 0x9E3779B97F4A7C15ull;
+  lb->numPeers = numPeers;
+  lb->peers = (LoopbackPeer*)calloc(numPeers, sizeof(LoopbackPeer));
+  lb->ctx = SSL_CTX_new(DTLS_client_method());
+  SSL_CTX_set_verify(lb->ctx, SSL_VERIFY_NONE, NULL);
+  SSL_CTX_set_options(lb->ctx, SSL_OP_NO_QUERY_MTU);
+
+  WuSetUserData(wu, lb);
+  WuSetUDPWriteFunction(wu, LoopbackWrite);
+}
+
+// Frees the peers, the Wu clients they connected are left as they are.
+inline void LoopbackDestroy(Loopback* lb) {
+  for (int32_t i = 0; i < lb->numPeers; i++) {
+    SSL_free(lb->peers[i].ssl);
+  }
+
+  SSL_CTX_free(lb->ctx);
+  free(lb->peers);
+  memset(lb, 0, sizeof(Loopback));
+}
+
+inline void LoopbackSendRaw(Loopback* lb, LoopbackPeer* peer,
+                            const uint8_t* data, int32_t length) {
+  if (lb->send) {
+    lb->send(lb, peer, data, length);
+    return;
+  }
+
+  WuHandleUDP(lb->wu, &peer->address, data, length);
+}
+
+inline void LoopbackFlush(Loopback* lb, LoopbackPeer* peer) {
+  uint8_t buf[4096];
+
+  while (BIO_ctrl_pending(peer->outBio) > 0) {
+    int bytes = BIO_read(peer->outBio, buf, sizeof(buf));
+    if (bytes > 0) {
+      LoopbackSendRaw(lb, peer, buf, bytes);
+    }
+  }
+}
+
+inline void LoopbackSendSctp(Loopback* lb, LoopbackPeer* peer,
+                             const SctpChunk* chunks, int32_t numChunks) {
+  SctpPacket packet;
+  packet.sourcePort = kLoopbackSctpPort;
+  packet.destionationPort = kLoopbackSctpPort;
+  packet.verificationTag = peer->verificationTag;
+
+  uint8_t buf[4096];
+  memset(buf, 0, sizeof(buf));
+  size_t length =
+      SerializeSctpPacket(&packet, chunks, numChunks, buf, sizeof(buf));
+
+  SSL_write(peer->ssl, buf, int(length));
+  LoopbackFlush(lb, peer);
+}
+
+inline void LoopbackSendData(Loopback* lb, LoopbackPeer* peer,
+                             uint32_t protoId, const uint8_t* data,
+                             int32_t length) {
+  SctpChunk chunk;
+  chunk.type = Sctp_Data;
+  chunk.flags = kSctpFlagCompleteUnreliable;
+  chunk.length = SctpDataChunkLength(length);
+  chunk.as.data.tsn = peer->tsn++;
+  chunk.as.data.streamId = 0;
+  chunk.as.data.streamSeq = 0;
+  chunk.as.data.protoId = protoId;
+  chunk.as.data.userData = data;
+  chunk.as.data.userDataLength = length;
+
+  LoopbackSendSctp(lb, peer, &chunk, 1);
+}
+
+inline void LoopbackSendBinary(Loopback* lb, LoopbackPeer* peer,
+                               const uint8_t* data, int32_t length) {
+  LoopbackSendData(lb, peer, 53, data, length);
+}
+
+static void LoopbackSendStun(Loopback* lb, LoopbackPeer* peer) {
+  uint8_t buf[256];
+  memset(buf, 0, sizeof(buf));
+
+  char username[64];
+  int32_t userLength = snprintf(username, sizeof(username), "%s:%s",
+                                peer->serverUfrag, peer->ufrag);
+  int32_t attribLength = userLength + PadSize(userLength, 4);
+
+  int32_t offset = WriteScalarSwapped(buf, uint16_t(0x0001));
+  offset += WriteScalarSwapped(buf + offset, uint16_t(4 + attribLength));
+  offset += WriteScalarSwapped(buf + offset, uint32_t(0x2112A442));
+  for (int32_t i = 0; i < 12; i++) {
+    buf[offset++] = uint8_t(i + 1);
+  }
+  offset += WriteScalarSwapped(buf + offset, uint16_t(0x0006));
+  offset += WriteScalarSwapped(buf + offset, uint16_t(userLength));
+  memcpy(buf + offset, username, userLength);
+  offset += attribLength;
+
+  LoopbackSendRaw(lb, peer, buf, offset);
+}
+
+static void LoopbackSendInit(Loopback* lb, LoopbackPeer* peer) {
+  // Serialized as an INIT-ACK, which has the same fixed fields, and retyped.
+  SctpChunk chunk;
+  chunk.type = Sctp_InitAck;
+  chunk.flags = 0;
+  chunk.length = kSctpMinInitAckLength;
+  chunk.as.init.initiateTag = 0x10000 + uint32_t(peer->address.port);
+  chunk.as.init.windowCredit = kSctpDefaultBufferSpace;
+  chunk.as.init.numOutboundStreams = 16;
+  chunk.as.init.numInboundStreams = 16;
+  chunk.as.init.initialTsn = peer->tsn;
+
+  SctpPacket packet;
+  packet.sourcePort = kLoopbackSctpPort;
+  packet.destionationPort = kLoopbackSctpPort;
+  packet.verificationTag = 0;
+
+  uint8_t buf[256];
+  memset(buf, 0, sizeof(buf));
+  size_t length = SerializeSctpPacket(&packet, &chunk, 1, buf, sizeof(buf));
+  buf[12] = Sctp_Init;
+  WriteScalar(buf + 8, uint32_t(0));
+  WriteScalar(buf + 8, htonl(SctpCRC32(buf, int32_t(length))));
+
+  SSL_write(peer->ssl, buf, int(length));
+  LoopbackFlush(lb, peer);
+}
+
+static bool LoopbackFindAttribute(const char* sdp, int32_t length,
+                                  const char* name, char* out,
+                                  size_t outLength) {
+  const char* end = sdp + length;
+  const char* found = strstr(sdp, name);
+  if (!found || found >= end) {
+    return false;
+  }
+
+  found += strlen(name);
+  size_t n = 0;
+  while (found + n < end && found[n] != '\\' && n + 1 < outLength) {
+    n++;
+  }
+
+  memcpy(out, found, n);
+  out[n] = '\0';
+  return true;
+}
+
+// Exchanges SDP for peer i and starts its STUN binding and DTLS handshake.
+inline bool LoopbackConnect(Loopback* lb, int32_t i) {
+  LoopbackPeer* peer = &lb->peers[i];
+  memset(peer, 0, sizeof(LoopbackPeer));
+  peer->address.host = kLoopbackHost;
+  peer->address.port = uint16_t(kLoopbackBasePort + i);
+  peer->tsn = 1000;
+  peer->rwnd = kSctpDefaultBufferSpace;
+  snprintf(peer->ufrag, sizeof(peer->ufrag), "lb%05d", i);
+
+  char offer[512];
+  int offerLength = snprintf(offer, sizeof(offer),
+                             "v=0\r\n"
+                             "o=- 0 2 IN IP4 127.0.0.1\r\n"
+                             "s=-\r\n"
+                             "t=0 0\r\n"
+                             "m=application 9 DTLS/SCTP 5000\r\n"
+                             "c=IN IP4 0.0.0.0\r\n"
+                             "a=ice-ufrag:%s\r\n"
+                             "a=ice-pwd:5nDmCqGk0uRtwq2qYV3hFdY7\r\n"
+                             "a=mid:data\r\n",
+                             peer->ufrag);
+
+  SDPResult res = WuExchangeSDP(lb->wu, offer, offerLength);
+  if (res.status != WuSDPStatus_Success) {
+    return false;
+  }
+
+  char answer[4096];
+  snprintf(answer, sizeof(answer), "%.*s", res.sdpLength, res.sdp);
+  if (!LoopbackFindAttribute(answer, res.sdpLength, "a=ice-ufrag:",
+                             peer->serverUfrag, sizeof(peer->serverUfrag))) {
+    return false;
+  }
+
+  peer->client = res.client;
+  peer->ssl = SSL_new(lb->ctx);
+  peer->inBio = BIO_new(BIO_s_mem());
+  BIO_set_mem_eof_return(peer->inBio, -1);
+  peer->outBio = BIO_new(BIO_s_mem());
+  BIO_set_mem_eof_return(peer->outBio, -1);
+  SSL_set_bio(peer->ssl, peer->inBio, peer->outBio);
+  SSL_set_connect_state(peer->ssl);
+  SSL_set_mtu(peer->ssl, 1200);
+
+  LoopbackSendStun(lb, peer);
+  SSL_do_handshake(peer->ssl);
+  LoopbackFlush(lb, peer);
+
+  return true;
+}
+
+// Acknowledges everything up to the last DATA chunk received.
+inline void LoopbackSendSack(Loopback* lb, LoopbackPeer* peer) {
+  SctpChunk sack;
+  sack.type = Sctp_Sack;
+  sack.flags = 0;
+  sack.length = SctpChunkLength(12);
+  sack.as.sack.cumulativeTsnAck = peer->lastDataTsn;
+  sack.as.sack.advRecvWindow = peer->rwnd;
+  sack.as.sack.numGapAckBlocks = 0;
+  sack.as.sack.numDupTsn = 0;
+  sack.as.sack.gapAckBlocks = NULL;
+  sack.as.sack.dupTsns = NULL;
+  LoopbackSendSctp(lb, peer, &sack, 1);
+}
+
+// A DCEP OPEN, channel type and priority are irrelevant to Wu.
+static void LoopbackOpenChunk(LoopbackPeer* peer, SctpChunk* chunk) {
+  static const uint8_t open[12] = {0x03, 0x81, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+  chunk->type = Sctp_Data;
+  chunk->flags = kSctpFlagCompleteUnreliable;
+  chunk->length = SctpDataChunkLength(sizeof(open));
+  chunk->as.data.tsn = peer->tsn++;
+  chunk->as.data.streamId = 0;
+  chunk->as.data.streamSeq = 0;
+  chunk->as.data.protoId = 50;
+  chunk->as.data.userData = open;
+  chunk->as.data.userDataLength = sizeof(open);
+}
+
+static void LoopbackHandleSctp(Loopback* lb, LoopbackPeer* peer,
+                               const uint8_t* buf, int32_t length) {
+  const size_t maxChunks = 16;
+  SctpChunk chunks[maxChunks];
+  SctpPacket packet;
+  size_t numChunks = 0;
+
+  if (!ParseSctpPacket(buf, length, &packet, chunks, maxChunks, &numChunks)) {
+    return;
+  }
+
+  bool receivedData = false;
+  bool cookieAcked = false;
+
+  for (size_t n = 0; n < numChunks; n++) {
+    const SctpChunk* chunk = &chunks[n];
+
+    if (chunk->type == Sctp_InitAck && length >= 20) {
+      ReadScalarSwapped(buf + 16, &peer->verificationTag);
+
+      // Unless unbundledOpen is set the DCEP OPEN rides along with the
+      // COOKIE-ECHO.
+      SctpChunk bundle[2];
+      bundle[0].type = Sctp_CookieEcho;
+      bundle[0].flags = 0;
+      bundle[0].length = SctpChunkLength(0);
+      if (lb->unbundledOpen) {
+        LoopbackSendSctp(lb, peer, bundle, 1);
+      } else {
+        LoopbackOpenChunk(peer, &bundle[1]);
+        LoopbackSendSctp(lb, peer, bundle, 2);
+      }
+    } else if (chunk->type == Sctp_CookieAck) {
+      cookieAcked = true;
+      if (lb->unbundledOpen && !peer->open) {
+        SctpChunk open;
+        LoopbackOpenChunk(peer, &open);
+        LoopbackSendSctp(lb, peer, &open, 1);
+      }
+    } else if (chunk->type == Sctp_Data) {
+      receivedData = true;
+      peer->lastDataTsn = chunk->as.data.tsn;
+      if (chunk->as.data.protoId == 50) {
+        peer->openedWithCookieAck = !peer->open && cookieAcked;
+        peer->open = true;
+      } else {
+        peer->received++;
+        peer->receivedBytes += chunk->as.data.userDataLength;
+        peer->lastMessageLength = Min(chunk->as.data.userDataLength,
+                                      int32_t(sizeof(peer->lastMessage)));
+        memcpy(peer->lastMessage, chunk->as.data.userData,
+               peer->lastMessageLength);
+      }
+    } else if (chunk->type == Sctp_Sack) {
+      peer->sackTsn = chunk->as.sack.cumulativeTsnAck;
+      peer->sackGapBlocks = chunk->as.sack.numGapAckBlocks;
+      peer->sackDupTsns = chunk->as.sack.numDupTsn;
+    } else if (chunk->type == SctpChunk_ForwardTsn) {
+      peer->forwardTsn = chunk->as.forwardTsn.newCumulativeTsn;
+    } else if (chunk->type == Sctp_HeartbeatAck) {
+      peer->heartbeatAcks++;
+      peer->heartbeatAckBytes += chunk->as.heartbeat.heartbeatInfoLen;
+    } else if (chunk->type == Sctp_Heartbeat) {
+      SctpChunk ack;
+      ack.type = Sctp_HeartbeatAck;
+      ack.flags = 0;
+      ack.length = chunk->length;
+      ack.as.heartbeat = chunk->as.heartbeat;
+      LoopbackSendSctp(lb, peer, &ack, 1);
+    }
+  }
+
+  if (receivedData && !peer->holdSacks) {
+    LoopbackSendSack(lb, peer);
+  }
+}
+
+// Processes everything the server sent to a peer since the last call.
+inline void LoopbackPumpPeer(Loopback* lb, LoopbackPeer* peer) {
+  if (!peer->ssl) {
+    return;
+  }
+
+  if (!SSL_is_init_finished(peer->ssl)) {
+    // Browsers retransmit their flight after a second without an answer.
+    if (BIO_ctrl_pending(peer->inBio) == 0) {
+      if (DTLSv1_handle_timeout(peer->ssl) > 0) {
+        LoopbackFlush(lb, peer);
+      }
+      return;
+    }
+
+    SSL_do_handshake(peer->ssl);
+    LoopbackFlush(lb, peer);
+
+    if (SSL_is_init_finished(peer->ssl)) {
+      LoopbackSendInit(lb, peer);
+    }
+    return;
+  }
+
+  // Memory BIOs don't keep datagram boundaries, a read can pull several
+  // records into the SSL buffer at once.
+  while (BIO_ctrl_pending(peer->inBio) > 0 || SSL_has_pending(peer->ssl)) {
+    uint8_t buf[8192];
+    int bytes = SSL_read(peer->ssl, buf, sizeof(buf));
+    if (bytes <= 0) {
+      break;
+    }
+
+    LoopbackHandleSctp(lb, peer, buf, bytes);
+  }
+}
+
+inline void LoopbackPump(Loopback* lb) {
+  for (int32_t i = 0; i < lb->numPeers; i++) {
+    LoopbackPumpPeer(lb, &lb->peers[i]);
+  }
+}
+
+// Connects all peers and runs until their data channels are open or the
+// number of rounds is exhausted. Events other than joins are discarded.
+inline int32_t LoopbackConnectAll(Loopback* lb, int32_t maxRounds) {
+  for (int32_t i = 0; i < lb->numPeers; i++) {
+    if (!LoopbackConnect(lb, i)) {
+      return 0;
+    }
+  }
+
+  for (int32_t round = 0; round < maxRounds; round++) {
+    LoopbackPump(lb);
+
+    WuEvent evt;
+    while (WuUpdate(lb->wu, &evt)) {
+    }
+
+    int32_t numOpen = 0;
+    for (int32_t i = 0; i < lb->numPeers; i++) {
+      numOpen += lb->peers[i].open ? 1 : 0;
+    }
+
+    if (numOpen == lb->numPeers) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+// WuInit, then connects numPeers peers with LoopbackConnectAll. Prints what
+// failed.
+inline bool LoopbackStart(Loopback* lb, Wu* wu, const WuConf* conf,
+                          int32_t numPeers, int32_t maxRounds = 50) {
+  memset(lb, 0, sizeof(Loopback));
+  if (!WuInit(wu, conf)) {
+    printf("WuInit failed\n");
+    return false;
+  }
+
+  LoopbackInit(lb, wu, numPeers);
+  if (!LoopbackConnectAll(lb, maxRounds)) {
+    printf("data channel didn't open\n");
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../Wu.h"
+#include "../WuClock.h"
+#include "../WuPcap.h"
+#include "../WuStun.h"
+
+// Feeds a capture written with WuConf::captureFile back through WuExchangeSDP
+// and WuHandleUDP, as fast as possible or with the original timing
+// (--realtime). Server ICE credentials differ from the recorded session, so
+// STUN usernames are rewritten to the new server ufrag of the same client.
+//
+// Wu answers with a new DTLS server random and key share, so recorded
+// handshakes stop after the ClientHello exchange and recorded application
+// data is rejected. The replay exercises signaling, STUN and the DTLS entry
+// path under the recorded traffic mix.
+
+struct ReplaySession {
+  char clientUfrag[64];
+  int32_t clientUfragLength;
+  char serverUfrag[64];
+  int32_t serverUfragLength;
+};
+
+struct Replay {
+  Wu wu;
+  ReplaySession* sessions;
+  int32_t numSessions;
+  int32_t sessionsCapacity;
+  int64_t datagrams;
+  int64_t offers;
+  int64_t rewritten;
+};
+
+static void WriteNothing(const uint8_t*, size_t, const WuClient*, void*) {}
+
+static int32_t FindAttribute(const char* sdp, int32_t length, const char* name,
+                             char* out, int32_t capacity) {
+  const int32_t nameLength = int32_t(strlen(name));
+  for (int32_t i = 0; i + nameLength <= length; i++) {
+    if (memcmp(sdp + i, name, nameLength) != 0) {
+      continue;
+    }
+
+    int32_t n = 0;
+    const char* value = sdp + i + nameLength;
+    const char* end = sdp + length;
+    while (value + n < end && value[n] != '\r' && value[n] != '\n' &&
+           value[n] != '\\' && value[n] != '"' && n < capacity) {
+      out[n] = value[n];
+      n++;
+    }
+
+    return n;
+  }
+
+  return 0;
+}
+
+static void HandleOffer(Replay* replay, const WuPcapPacket* packet) {
+  replay->offers++;
+
+  const SDPResult res =
+      WuExchangeSDP(&replay->wu, (const char*)packet->data, packet->length);
+  if (res.status != WuSDPStatus_Success) {
+    return;
+  }
+
+  if (replay->numSessions == replay->sessionsCapacity) {
+    replay->sessionsCapacity = replay->sessionsCapacity * 2 + 64;
+    replay->sessions = (ReplaySession*)realloc(
+        replay->sessions, replay->sessionsCapacity * sizeof(ReplaySession));
+  }
+
+  ReplaySession* session = &replay->sessions[replay->numSessions];
+  session->clientUfragLength =
+      FindAttribute((const char*)packet->data, packet->length, "a=ice-ufrag:",
+                    session->clientUfrag, sizeof(session->clientUfrag));
+  session->serverUfragLength =
+      FindAttribute(res.sdp, res.sdpLength, "a=ice-ufrag:",
+                    session->serverUfrag, sizeof(session->serverUfrag));
+
+  if (session->clientUfragLength > 0 && session->serverUfragLength > 0) {
+    replay->numSessions++;
+  }
+}
+
+// Rewrites the server half of the STUN username in place. Incoming message
+// integrity isn't checked by Wu.
+static void RewriteStun(Replay* replay, uint8_t* data, int32_t length) {
+  StunPacket stun;
+  if (!ParseStun(data, length, &stun)) {
+    return;
+  }
+
+  const ReplaySession* session = NULL;
+  for (int32_t i = replay->numSessions - 1; i >= 0; i--) {
+    const ReplaySession* s = &replay->sessions[i];
+    if (MemEqual(s->clientUfrag, s->clientUfragLength,
+                 stun.remoteUser.identifier, stun.remoteUser.length)) {
+      session = s;
+      break;
+    }
+  }
+
+  if (!session || session->serverUfragLength != stun.serverUser.length) {
+    return;
+  }
+
+  const int32_t userLength = stun.serverUser.length;
+  for (int32_t i = 0; i + userLength < length; i++) {
+    if (data[i + userLength] == ':' &&
+        memcmp(data + i, stun.serverUser.identifier, userLength) == 0) {
+      memcpy(data + i, session->serverUfrag, userLength);
+      replay->rewritten++;
+      return;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    printf("usage: %s capture.pcap [--realtime]\n", argv[0]);
+    return 1;
+  }
+
+  const bool realtime = argc > 2 && strcmp(argv[2], "--realtime") == 0;
+
+  FILE* file = WuPcapOpen(argv[1]);
+  if (!file) {
+    printf("failed to open %s\n", argv[1]);
+    return 1;
+  }
+
+  Replay replay;
+  memset(&replay, 0, sizeof(replay));
+
+  WuConf conf;
+  conf.maxClients = 1 << 16;
+  if (!WuInit(&replay.wu, &conf)) {
+    printf("WuInit failed\n");
+    return 1;
+  }
+
+  WuSetUDPWriteFunction(&replay.wu, WriteNothing);
+
+  static uint8_t buf[65536];
+  WuPcapPacket packet;
+  double captureStart = -1.0;
+  const double start = MsNow() * 0.001;
+
+  while (WuPcapRead(file, buf, sizeof(buf), &packet)) {
+    if (captureStart < 0.0) {
+      captureStart = packet.time;
+    }
+
+    if (realtime) {
+      const double delay =
+          (packet.time - captureStart) - (MsNow() * 0.001 - start);
+      if (delay > 0.0) {
+        usleep(useconds_t(delay * 1e6));
+      }
+    }
+
+    if (packet.protocol == WuPcap_Tcp) {
+      HandleOffer(&replay, &packet);
+    } else {
+      RewriteStun(&replay, (uint8_t*)packet.data, packet.length);
+      WuHandleUDP(&replay.wu, &packet.remote, packet.data, packet.length);
+      replay.datagrams++;
+    }
+
+    if (realtime || replay.datagrams % 64 == 0) {
+      WuEvent evt;
+      while (WuUpdate(&replay.wu, &evt)) {
+      }
+    }
+  }
+
+  const double elapsed = MsNow() * 0.001 - start;
+  printf("%lld offers, %lld datagrams (%lld STUN rewritten) in %.3f s\n",
+         (long long)replay.offers, (long long)replay.datagrams,
+         (long long)replay.rewritten, elapsed);
+  printf("%.0f datagrams/s, %llu handshakes, %d clients\n",
+         elapsed > 0.0 ? replay.datagrams / elapsed : 0.0,
+         (unsigned long long)replay.wu.stats.handshakes,
+         replay.wu.numClients);
+
+  fclose(file);
+  return 0;
+}
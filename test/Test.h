@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdio.h>
+
+// Checks for the ctest programs. A failed Expect is printed and counted, and
+// the test carries on; main returns TestResult().
+
+static int failures = 0;
+
+static void Expect(bool condition, const char* what) {
+  if (!condition) {
+    printf("FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+static int TestResult() {
+  if (failures == 0) {
+    printf("all passed\n");
+  }
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include "../Wu.h"
+#include "../WuCommandQueue.h"
+#include "Loopback.h"
+#include "Test.h"
+
+// Commands pushed concurrently from several threads arrive whole and in
+// per-thread order across wrap-arounds of a small ring, and queued sends and
+// removals run on the next WuUpdate tick, dropping commands for clients that
+// left.
+
+const int32_t kProducers = 4;
+const uint32_t kCommandsPerProducer = 20000;
+
+struct Received {
+  uint32_t next[kProducers];
+  int32_t corrupt;
+  uint32_t total;
+};
+
+static void Produce(WuCommandQueue* q, uint32_t producer) {
+  uint8_t payload[48];
+  for (uint32_t seq = 0; seq < kCommandsPerProducer; seq++) {
+    const int32_t length = 8 + int32_t(seq % 40);
+    memcpy(payload, &seq, 4);
+    memset(payload + 4, int(producer + seq), length - 4);
+    while (!WuCommandQueuePush(q, WuCommand_SendBinary, NULL, producer,
+                               payload, length)) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+static void Check(const WuCommand* command, const uint8_t* data,
+                  void* userData) {
+  Received* received = (Received*)userData;
+  const uint32_t producer = command->clientId;
+  uint32_t seq;
+  memcpy(&seq, data, 4);
+
+  bool ok = producer < kProducers && seq == received->next[producer] &&
+            command->length == 8 + int32_t(seq % 40);
+  for (int32_t i = 4; ok && i < command->length; i++) {
+    ok = data[i] == uint8_t(producer + seq);
+  }
+
+  if (ok) {
+    received->next[producer]++;
+  } else {
+    received->corrupt++;
+  }
+  received->total++;
+}
+
+static void TestConcurrentPush() {
+  WuAllocator allocator;
+  WuCommandQueue* q = WuCommandQueueCreate(&allocator, 4096);
+
+  Received received;
+  memset(&received, 0, sizeof(received));
+
+  std::thread producers[kProducers];
+  for (int32_t i = 0; i < kProducers; i++) {
+    producers[i] = std::thread(Produce, q, uint32_t(i));
+  }
+
+  const uint32_t expected = kProducers * kCommandsPerProducer;
+  while (received.total < expected) {
+    if (!WuCommandQueueDrain(q, Check, &received)) {
+      std::this_thread::yield();
+    }
+  }
+
+  for (int32_t i = 0; i < kProducers; i++) {
+    producers[i].join();
+  }
+
+  Expect(received.corrupt == 0, "commands arrive whole and in order");
+  Expect(received.total == expected, "every command drained");
+  Expect(WuCommandQueueDrain(q, Check, &received) == 0, "queue left empty");
+
+  uint8_t big[4096];
+  Expect(!WuCommandQueuePush(q, WuCommand_SendBinary, NULL, 0, big,
+                             sizeof(big)),
+         "command larger than half the ring is refused");
+
+  WuCommandQueueDestroy(q);
+}
+
+static void TestQueuedSends() {
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+  conf.commandQueueSize = 1 << 16;
+
+  Loopback lb;
+  if (!LoopbackStart(&lb, &wu, &conf, 2)) {
+    failures++;
+    return;
+  }
+
+  LoopbackPeer* peer = &lb.peers[0];
+  LoopbackPeer* leaving = &lb.peers[1];
+  const uint32_t id = WuClientGetId(peer->client);
+  const uint32_t leavingId = WuClientGetId(leaving->client);
+  const int32_t receivedBefore = peer->received;
+
+  const uint8_t message[5] = {1, 2, 3, 4, 5};
+  Expect(WuEnqueueSendBinary(&wu, peer->client, id, message, sizeof(message)),
+         "send enqueued");
+  Expect(WuEnqueueSendText(&wu, peer->client, id, "text", 4),
+         "text enqueued");
+  Expect(WuEnqueueRemoveClient(&wu, leaving->client, leavingId),
+         "removal enqueued");
+  Expect(WuEnqueueSendBinary(&wu, leaving->client, leavingId, message,
+                             sizeof(message)),
+         "send after removal enqueued");
+  Expect(WuEnqueueSendBinary(&wu, peer->client, id + 100, message,
+                             sizeof(message)),
+         "send with a stale id enqueued");
+
+  LoopbackPump(&lb);
+  Expect(peer->received == receivedBefore, "nothing sent before the tick");
+
+  WuEvent evt;
+  while (WuUpdate(&wu, &evt)) {
+  }
+  LoopbackPump(&lb);
+
+  Expect(peer->received == receivedBefore + 2, "queued sends delivered");
+  Expect(peer->lastMessageLength == 4 &&
+             memcmp(peer->lastMessage, "text", 4) == 0,
+         "queued text delivered last");
+  Expect(wu.numClients == 1, "queued removal ran");
+  Expect(wu.stats.droppedCommands == 2, "commands for gone clients dropped");
+
+  LoopbackDestroy(&lb);
+
+  Wu disabled;
+  WuConf disabledConf;
+  if (WuInit(&disabled, &disabledConf)) {
+    Expect(!WuEnqueueSendBinary(&disabled, NULL, 0, message, sizeof(message)),
+           "enqueue fails without a queue");
+  }
+}
+
+int main() {
+  TestConcurrentPush();
+  TestQueuedSends();
+
+  return TestResult();
+}
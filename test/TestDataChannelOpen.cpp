@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include "../Wu.h"
+#include "Loopback.h"
+#include "Test.h"
+
+// A DCEP OPEN bundled with the COOKIE-ECHO is acknowledged in the packet
+// carrying the COOKIE-ACK, and one sent after the COOKIE-ACK, the order
+// browsers use, still opens the channel.
+
+static void TestOpen(bool unbundled) {
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+
+  if (!WuInit(&wu, &conf)) {
+    printf("WuInit failed\n");
+    failures++;
+    return;
+  }
+
+  Loopback lb;
+  LoopbackInit(&lb, &wu, 1);
+  lb.unbundledOpen = unbundled;
+
+  int32_t joins = 0;
+  LoopbackConnect(&lb, 0);
+  for (int32_t round = 0; round < 50 && !lb.peers[0].open; round++) {
+    LoopbackPump(&lb);
+    WuEvent evt;
+    while (WuUpdate(&wu, &evt)) {
+      joins += evt.type == WuEvent_ClientJoin ? 1 : 0;
+    }
+  }
+
+  Expect(lb.peers[0].open && joins == 1,
+         unbundled ? "unbundled open" : "bundled open");
+  Expect(lb.peers[0].openedWithCookieAck == !unbundled,
+         unbundled ? "DCEP ACK after the COOKIE-ACK"
+                   : "DCEP ACK bundled with the COOKIE-ACK");
+
+  LoopbackDestroy(&lb);
+}
+
+int main() {
+  TestOpen(false);
+  TestOpen(true);
+
+  return TestResult();
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include "../Wu.h"
+#include "Loopback.h"
+#include "Test.h"
+
+// Sends stop at the peer's advertised receive window, the buffered amount
+// follows the peer's SACKs, and WuEvent_ClientWritable fires once a client
+// past WuConf::sendHighWatermark drains.
+
+const int32_t kHighWatermark = 4096;
+const int32_t kMessageSize = 1000;
+
+static int32_t CountWritable(Wu* wu) {
+  int32_t writable = 0;
+  WuEvent evt;
+  while (WuUpdate(wu, &evt)) {
+    writable += evt.type == WuEvent_ClientWritable ? 1 : 0;
+  }
+  return writable;
+}
+
+int main() {
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+  conf.sendHighWatermark = kHighWatermark;
+
+  Loopback lb;
+  if (!LoopbackStart(&lb, &wu, &conf, 1)) {
+    return 1;
+  }
+
+  LoopbackPeer* peer = &lb.peers[0];
+  WuClient* client = peer->client;
+  uint8_t message[kMessageSize];
+  memset(message, 0x5a, sizeof(message));
+
+  Expect(WuClientGetBufferedAmount(client) == 0, "nothing buffered on open");
+
+  // A stalled tab: nothing is acknowledged.
+  peer->holdSacks = true;
+  for (int32_t i = 0; i < 5; i++) {
+    Expect(WuSendBinary(&wu, client, message, sizeof(message)) == 0,
+           "send below the window");
+  }
+  LoopbackPump(&lb);
+  Expect(WuClientGetBufferedAmount(client) == 5 * kMessageSize,
+         "unacknowledged sends are buffered");
+  Expect(CountWritable(&wu) == 0, "no writable event while buffered");
+
+  peer->holdSacks = false;
+  LoopbackSendSack(&lb, peer);
+  Expect(WuClientGetBufferedAmount(client) == 0, "SACK drains the buffer");
+  Expect(CountWritable(&wu) == 1, "writable after crossing the watermark");
+
+  // A slow tab advertising a small window.
+  peer->rwnd = 2 * kMessageSize + kMessageSize / 2;
+  LoopbackSendSack(&lb, peer);
+  peer->holdSacks = true;
+  Expect(WuSendBinary(&wu, client, message, sizeof(message)) == 0, "first");
+  Expect(WuSendBinary(&wu, client, message, sizeof(message)) == 0, "second");
+  Expect(WuSendBinary(&wu, client, message, sizeof(message)) < 0,
+         "send past the peer window is refused");
+  LoopbackPump(&lb);
+  Expect(peer->received == 7, "refused message not sent");
+
+  peer->holdSacks = false;
+  peer->rwnd = kSctpDefaultBufferSpace;
+  LoopbackSendSack(&lb, peer);
+  Expect(CountWritable(&wu) == 1, "writable after a refused send");
+  Expect(WuSendBinary(&wu, client, message, sizeof(message)) == 0,
+         "send after the window opens");
+
+  LoopbackDestroy(&lb);
+
+  return TestResult();
+}
@@ -0,0 +1,161 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../Wu.h"
+#include "../WuQueue.h"
+#include "Loopback.h"
+#include "Test.h"
+
+// Datagrams are classified by their first byte, handshake datagrams wait for
+// the tick while established clients are serviced on arrival, and the
+// handshake budget spreads a burst of handshakes over several ticks. A
+// datagram or event the queues can't grow for is counted as dropped.
+
+static bool RunUntilOpen(Loopback* lb, int32_t peer, int32_t maxRounds) {
+  for (int32_t round = 0; round < maxRounds && !lb->peers[peer].open;
+       round++) {
+    LoopbackPump(lb);
+    WuEvent evt;
+    while (WuUpdate(lb->wu, &evt)) {
+    }
+  }
+
+  return lb->peers[peer].open;
+}
+
+static bool failAllocations = false;
+
+static void* Allocate(size_t size, void*) {
+  return failAllocations ? NULL : malloc(size);
+}
+
+static void* Reallocate(void* ptr, size_t size, void*) {
+  return failAllocations ? NULL : realloc(ptr, size);
+}
+
+static void Deallocate(void* ptr, void*) { free(ptr); }
+
+static void TestGrowFailure() {
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+  conf.allocator.allocate = Allocate;
+  conf.allocator.reallocate = Reallocate;
+  conf.allocator.deallocate = Deallocate;
+
+  if (!WuInit(&wu, &conf)) {
+    printf("WuInit failed\n");
+    failures++;
+    return;
+  }
+
+  Loopback lb;
+  LoopbackInit(&lb, &wu, 1);
+  LoopbackConnect(&lb, 0);
+
+  // Fills the queue with the client hello and records it never parses.
+  const uint8_t record[13] = {22, 0xfe, 0xfd};
+  const WuAddress* address = &lb.peers[0].address;
+  while (wu.handshakeQueue->length < wu.handshakeQueue->capacity) {
+    WuHandleUDP(&wu, address, record, sizeof(record));
+  }
+
+  const uint64_t queued = wu.stats.queuedHandshakeDatagrams;
+  failAllocations = true;
+  WuHandleUDP(&wu, address, record, sizeof(record));
+  failAllocations = false;
+  Expect(wu.stats.queuedHandshakeDatagrams == queued &&
+             wu.stats.droppedHandshakeDatagrams == 1,
+         "datagram dropped when the queue can't grow");
+
+  LoopbackDestroy(&lb);
+}
+
+static void TestEventGrowFailure() {
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+  conf.allocator.allocate = Allocate;
+  conf.allocator.reallocate = Reallocate;
+  conf.allocator.deallocate = Deallocate;
+
+  Loopback lb;
+  if (!LoopbackStart(&lb, &wu, &conf, 1)) {
+    failures++;
+    return;
+  }
+
+  const uint8_t message[4] = {1, 2, 3, 4};
+  while (wu.pendingEvents->length < wu.pendingEvents->capacity) {
+    LoopbackSendBinary(&lb, &lb.peers[0], message, sizeof(message));
+  }
+
+  failAllocations = true;
+  LoopbackSendBinary(&lb, &lb.peers[0], message, sizeof(message));
+  failAllocations = false;
+  Expect(wu.stats.droppedEvents == 1,
+         "event dropped when the queue can't grow");
+
+  LoopbackDestroy(&lb);
+}
+
+int main() {
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+  // One handshake datagram per tick.
+  conf.handshakeBudget = 1e-9;
+
+  if (!WuInit(&wu, &conf)) {
+    printf("WuInit failed\n");
+    return 1;
+  }
+
+  Loopback lb;
+  LoopbackInit(&lb, &wu, 3);
+  if (!LoopbackConnect(&lb, 0) || !RunUntilOpen(&lb, 0, 50)) {
+    printf("data channel didn't open\n");
+    return 1;
+  }
+
+  LoopbackPeer* established = &lb.peers[0];
+  const uint64_t queued = wu.stats.queuedHandshakeDatagrams;
+  Expect(queued > 0, "handshake datagrams went through the queue");
+
+  // Two new clients start their handshakes, then established data arrives.
+  LoopbackConnect(&lb, 1);
+  LoopbackConnect(&lb, 2);
+  Expect(wu.stats.queuedHandshakeDatagrams == queued + 2,
+         "client hellos queued");
+  Expect(BIO_ctrl_pending(lb.peers[1].inBio) == 0,
+         "no handshake work before the tick");
+
+  const uint8_t message[4] = {1, 2, 3, 4};
+  LoopbackSendBinary(&lb, established, message, sizeof(message));
+
+  WuEvent evt;
+  Expect(WuUpdate(&wu, &evt) && evt.type == WuEvent_BinaryData,
+         "established data delivered ahead of queued handshakes");
+
+  while (WuUpdate(&wu, &evt)) {
+  }
+  Expect(wu.stats.handshakeBudgetHits == 1, "budget spreads the burst");
+  Expect((BIO_ctrl_pending(lb.peers[1].inBio) > 0) !=
+             (BIO_ctrl_pending(lb.peers[2].inBio) > 0),
+         "one handshake served per tick");
+
+  Expect(RunUntilOpen(&lb, 1, 50) && RunUntilOpen(&lb, 2, 50),
+         "queued handshakes complete");
+
+  const uint8_t rtp[12] = {0x80, 0x60};
+  const uint8_t turn[8] = {0x40, 0x00};
+  WuHandleUDP(&wu, &established->address, rtp, sizeof(rtp));
+  WuHandleUDP(&wu, &established->address, turn, sizeof(turn));
+  Expect(wu.stats.unclassifiedDatagrams == 2, "RTP and TURN dropped");
+
+  LoopbackDestroy(&lb);
+
+  TestGrowFailure();
+  TestEventGrowFailure();
+
+  return TestResult();
+}
@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <unistd.h>
+#include "../Wu.h"
+#include "Loopback.h"
+
+// Fails when the bytes WuGetMemoryStats reports per client grow past a
+// budget. Idle clients (SDP exchange only), open clients (data channel
+// established) and hibernated ones are checked separately. Only raise a
+// budget deliberately.
+
+const int32_t kNumClients = 256;
+const size_t kIdleClientBudget = 1024;
+const size_t kOpenClientBudget = 80 * 1024;
+const size_t kHibernatedClientBudget = 40 * 1024;
+
+static const char kOffer[] =
+    "v=0\r\n"
+    "o=- 0 2 IN IP4 127.0.0.1\r\n"
+    "s=-\r\n"
+    "t=0 0\r\n"
+    "m=application 9 DTLS/SCTP 5000\r\n"
+    "c=IN IP4 0.0.0.0\r\n"
+    "a=ice-ufrag:Qf3a\r\n"
+    "a=ice-pwd:5nDmCqGk0uRtwq2qYV3hFdY7\r\n"
+    "a=mid:data\r\n";
+
+static size_t TotalBytes(const Wu* wu) {
+  WuMemoryStats stats;
+  WuGetMemoryStats(wu, &stats);
+  return stats.total;
+}
+
+static bool Init(Wu* wu, double hibernateTimeout = 0.0) {
+  WuConf conf;
+  conf.maxClients = kNumClients;
+  conf.clientChunkSize = kNumClients;
+  conf.installSslAllocator = true;
+  conf.hibernateTimeout = hibernateTimeout;
+  // All handshakes every tick, the connect loops have a fixed round count.
+  conf.handshakeBudget = 0.0;
+
+  if (!WuInit(wu, &conf)) {
+    printf("WuInit failed\n");
+    return false;
+  }
+
+  WuMemoryStats stats;
+  WuGetMemoryStats(wu, &stats);
+  if (stats.ssl < 0) {
+    printf("OpenSSL allocations are not tracked\n");
+    return false;
+  }
+
+  return true;
+}
+
+static int Check(const char* name, size_t before, size_t after,
+                 size_t budget) {
+  const size_t perClient = (after - before) / kNumClients;
+  printf("%s: %zu bytes/client, budget %zu\n", name, perClient, budget);
+  return perClient <= budget ? 0 : 1;
+}
+
+static int CheckIdle() {
+  Wu wu;
+  if (!Init(&wu)) {
+    return 1;
+  }
+
+  const size_t before = TotalBytes(&wu);
+
+  for (int32_t i = 0; i < kNumClients; i++) {
+    SDPResult res = WuExchangeSDP(&wu, kOffer, sizeof(kOffer) - 1);
+    if (res.status != WuSDPStatus_Success) {
+      printf("SDP exchange failed at %d\n", i);
+      return 1;
+    }
+  }
+
+  const size_t after = TotalBytes(&wu);
+
+  // Offers past maxClients replace the oldest client that never bound.
+  SDPResult res = WuExchangeSDP(&wu, kOffer, sizeof(kOffer) - 1);
+  if (res.status != WuSDPStatus_Success || wu.numClients != kNumClients) {
+    printf("SDP exchange with a full client pool failed\n");
+    return 1;
+  }
+
+  return Check("idle", before, after, kIdleClientBudget);
+}
+
+static int CheckOpen() {
+  Wu wu;
+  if (!Init(&wu)) {
+    return 1;
+  }
+
+  const size_t before = TotalBytes(&wu);
+
+  Loopback lb;
+  LoopbackInit(&lb, &wu, kNumClients);
+  if (!LoopbackConnectAll(&lb, 50)) {
+    printf("not all data channels opened\n");
+    return 1;
+  }
+
+  // OpenSSL allocations are process wide, drop the peers' share.
+  LoopbackDestroy(&lb);
+
+  return Check("open", before, TotalBytes(&wu), kOpenClientBudget);
+}
+
+static int CheckHibernated() {
+  Wu wu;
+  if (!Init(&wu, 0.01)) {
+    return 1;
+  }
+
+  const size_t before = TotalBytes(&wu);
+
+  Loopback lb;
+  LoopbackInit(&lb, &wu, kNumClients);
+  if (!LoopbackConnectAll(&lb, 50)) {
+    printf("not all data channels opened\n");
+    return 1;
+  }
+
+  usleep(20000);
+
+  WuEvent evt;
+  while (WuUpdate(&wu, &evt)) {
+  }
+
+  if (wu.numHibernatedClients != kNumClients) {
+    printf("only %d clients hibernated\n", wu.numHibernatedClients);
+    return 1;
+  }
+
+  // Keep-alive traffic doesn't wake a client up and must leave it compacted.
+  const uint8_t info[8] = {0};
+  SctpChunk heartbeat;
+  heartbeat.type = Sctp_Heartbeat;
+  heartbeat.flags = 0;
+  heartbeat.length = SctpChunkLength(4 + sizeof(info));
+  heartbeat.as.heartbeat.heartbeatInfoLen = sizeof(info);
+  heartbeat.as.heartbeat.heartbeatInfo = info;
+  for (int32_t i = 0; i < kNumClients; i++) {
+    LoopbackSendSctp(&lb, &lb.peers[i], &heartbeat, 1);
+  }
+
+  LoopbackPump(&lb);
+  for (int32_t i = 0; i < kNumClients; i++) {
+    if (lb.peers[i].heartbeatAcks != 1) {
+      printf("peer %d got %d heartbeat acks\n", i, lb.peers[i].heartbeatAcks);
+      return 1;
+    }
+  }
+
+  if (wu.numHibernatedClients != kNumClients) {
+    printf("heartbeats woke %d clients\n",
+           kNumClients - wu.numHibernatedClients);
+    return 1;
+  }
+
+  LoopbackDestroy(&lb);
+
+  return Check("hibernated", before, TotalBytes(&wu), kHibernatedClientBudget);
+}
+
+int main() {
+  int failed = CheckIdle();
+  failed |= CheckOpen();
+  failed |= CheckHibernated();
+  return failed;
+}
@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include "../Wu.h"
+#include "Loopback.h"
+#include "Test.h"
+
+// The overload controller climbs a level at each threshold of the iteration
+// budget, refuses offers, drops low priority sends and disconnects the most
+// expensive client at the top level, and steps back down once iterations
+// are cheap again.
+
+const double kBudget = 0.010;
+
+// Long enough for the smoothed iteration time to settle.
+static void Iterate(Wu* wu, double busyTime) {
+  for (int32_t i = 0; i < 64; i++) {
+    WuOverloadUpdate(wu, busyTime);
+  }
+}
+
+int main() {
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+  conf.overloadBudget = kBudget;
+
+  Loopback lb;
+  if (!LoopbackStart(&lb, &wu, &conf, 2)) {
+    return 1;
+  }
+
+  const char offer[] =
+      "v=0\r\n"
+      "m=application 9 DTLS/SCTP 5000\r\n"
+      "a=ice-ufrag:Qf3a\r\n"
+      "a=ice-pwd:5nDmCqGk0uRtwq2qYV3hFdY7\r\n"
+      "a=mid:data\r\n";
+  const uint8_t message[4] = {1, 2, 3, 4};
+  WuClient* client = lb.peers[0].client;
+
+  Iterate(&wu, kBudget * 0.5);
+  Expect(WuGetOverloadLevel(&wu) == WuOverload_None, "within budget");
+
+  Iterate(&wu, kBudget * 1.2);
+  Expect(WuGetOverloadLevel(&wu) == WuOverload_PauseAdmissions,
+         "admissions paused");
+  Expect(WuExchangeSDP(&wu, offer, sizeof(offer) - 1).status ==
+             WuSDPStatus_Overloaded,
+         "offer refused");
+  Expect(WuSendBinaryLowPriority(&wu, client, message, sizeof(message)) == 0,
+         "low priority still sent");
+
+  Iterate(&wu, kBudget * 1.7);
+  Expect(WuGetOverloadLevel(&wu) == WuOverload_DeferHeartbeats,
+         "heartbeats deferred");
+
+  Iterate(&wu, kBudget * 2.5);
+  Expect(WuGetOverloadLevel(&wu) == WuOverload_DropLowPriority,
+         "low priority dropped");
+  Expect(WuSendBinaryLowPriority(&wu, client, message, sizeof(message)) < 0,
+         "low priority send dropped");
+  Expect(WuSendBinary(&wu, client, message, sizeof(message)) == 0,
+         "normal send still goes out");
+
+  WuClientCost top;
+  WuTopClientsByCost(&wu, &top, 1);
+  Iterate(&wu, kBudget * 4.0);
+  Expect(WuGetOverloadLevel(&wu) == WuOverload_Disconnect, "shedding clients");
+
+  // Leave events are pushed at the end of a tick and polled on the next.
+  WuClient* left = NULL;
+  for (int32_t tick = 0; tick < 2; tick++) {
+    WuEvent evt;
+    while (WuUpdate(&wu, &evt)) {
+      if (evt.type == WuEvent_ClientLeave) {
+        left = evt.client;
+      }
+    }
+  }
+  Expect(left == top.client, "most expensive client disconnected");
+  Expect(wu.stats.overloadDisconnects == 1, "one disconnect per interval");
+  Expect(wu.stats.overloadRefusedOffers == 1 &&
+             wu.stats.overloadDroppedMessages == 1,
+         "actions counted");
+
+  // Hysteresis keeps the level just below its threshold.
+  Iterate(&wu, kBudget * 2.9);
+  Expect(WuGetOverloadLevel(&wu) == WuOverload_Disconnect, "hysteresis");
+
+  Iterate(&wu, kBudget * 0.2);
+  Expect(WuGetOverloadLevel(&wu) == WuOverload_None, "recovered");
+  Expect(WuExchangeSDP(&wu, offer, sizeof(offer) - 1).status ==
+             WuSDPStatus_Success,
+         "offers accepted again");
+
+  LoopbackDestroy(&lb);
+
+  return TestResult();
+}
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "../Wu.h"
+#include "../WuSctp.h"
+#include "Loopback.h"
+#include "Test.h"
+
+// A patched DATA packet matches one serialized for the client, WuPublish
+// reaches every member exactly once, and members are dropped from their
+// topics when they're removed.
+
+static void TestPatchDataPacket() {
+  const uint8_t message[5] = {1, 2, 3, 4, 5};
+  iovec buffer;
+  buffer.iov_base = (void*)message;
+  buffer.iov_len = sizeof(message);
+
+  SctpPacket packet;
+  packet.sourcePort = 5000;
+  packet.destionationPort = 0;
+  packet.verificationTag = 0;
+
+  SctpChunk chunk;
+  chunk.type = Sctp_Data;
+  chunk.flags = kSctpFlagCompleteUnreliable;
+  chunk.length = SctpDataChunkLength(sizeof(message));
+  chunk.as.data.tsn = 0;
+  chunk.as.data.streamId = 0;
+  chunk.as.data.streamSeq = 0;
+  chunk.as.data.protoId = 53;
+  chunk.as.data.userData = NULL;
+  chunk.as.data.userDataLength = sizeof(message);
+  chunk.as.data.userDataV = &buffer;
+  chunk.as.data.userDataVCount = 1;
+
+  uint8_t patched[64];
+  const size_t length =
+      SerializeSctpPacket(&packet, &chunk, 1, patched, sizeof(patched));
+  SctpPatchDataPacket(patched, length, 5001, 0xDEADBEEF, 42);
+
+  packet.destionationPort = 5001;
+  packet.verificationTag = 0xDEADBEEF;
+  chunk.as.data.tsn = 42;
+  uint8_t expected[64];
+  SerializeSctpPacket(&packet, &chunk, 1, expected, sizeof(expected));
+
+  Expect(memcmp(patched, expected, length) == 0,
+         "patched packet matches a serialized one");
+}
+
+static int32_t Received(const Loopback* lb) {
+  int32_t received = 0;
+  for (int32_t i = 0; i < lb->numPeers; i++) {
+    received += lb->peers[i].received;
+  }
+  return received;
+}
+
+static void TestPublish() {
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+
+  Loopback lb;
+  if (!LoopbackStart(&lb, &wu, &conf, 3)) {
+    failures++;
+    return;
+  }
+
+  LoopbackPeer* peers = lb.peers;
+  WuTopic* topic = WuCreateTopic(&wu);
+  WuTopic* other = WuCreateTopic(&wu);
+  Expect(WuSubscribe(&wu, topic, peers[0].client), "subscribe");
+  Expect(WuSubscribe(&wu, topic, peers[1].client), "subscribe another");
+  Expect(WuSubscribe(&wu, topic, peers[1].client), "subscribe twice");
+  Expect(WuSubscribe(&wu, other, peers[1].client), "subscribe elsewhere");
+  Expect(WuTopicGetMemberCount(topic) == 2, "subscribed once");
+
+  const int32_t before[3] = {peers[0].received, peers[1].received,
+                             peers[2].received};
+  const uint8_t message[7] = {'p', 'u', 'b', 's', 'u', 'b', '!'};
+  Expect(WuPublish(&wu, topic, message, sizeof(message)) == 2,
+         "published to both members");
+  Expect(WuPublishText(&wu, topic, "text", 4) == 2, "published text");
+  LoopbackPump(&lb);
+
+  Expect(peers[0].received == before[0] + 2, "first member received");
+  Expect(peers[1].received == before[1] + 2, "second member received");
+  Expect(peers[2].received == before[2], "non member received nothing");
+  Expect(peers[0].lastMessageLength == 4 &&
+             memcmp(peers[0].lastMessage, "text", 4) == 0,
+         "published text delivered");
+
+  WuRemoveClient(&wu, peers[1].client);
+  Expect(WuTopicGetMemberCount(topic) == 1, "removed client left the topic");
+  Expect(WuTopicGetMemberCount(other) == 0, "and every other topic");
+
+  const int32_t total = Received(&lb);
+  Expect(WuPublish(&wu, topic, message, sizeof(message)) == 1,
+         "published to the remaining member");
+  LoopbackPump(&lb);
+  Expect(Received(&lb) == total + 1, "only the remaining member received");
+
+  WuUnsubscribe(&wu, topic, peers[0].client);
+  Expect(WuPublish(&wu, topic, message, sizeof(message)) == 0,
+         "empty topic");
+
+  WuDestroyTopic(&wu, other);
+  WuDestroyTopic(&wu, topic);
+  Expect(wu.numTopics == 0, "topics destroyed");
+
+  LoopbackDestroy(&lb);
+}
+
+int main() {
+  TestPatchDataPacket();
+  TestPublish();
+
+  return TestResult();
+}
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <string.h>
+#include "../Wu.h"
+#include "../WuSctp.h"
+#include "Loopback.h"
+#include "Test.h"
+
+// Responses to one inbound packet are bundled only as far as they fit an
+// SCTP packet: HEARTBEAT-ACKs that echo large heartbeat info go out in
+// packets of their own, and a heartbeat whose ack can't fit any packet isn't
+// answered.
+
+const int32_t kLargeInfo = 2600;
+
+// Sends a packet larger than LoopbackSendSctp allows, in one datagram.
+static void SendHeartbeats(Loopback* lb, LoopbackPeer* peer, int32_t count,
+                           int32_t infoLength) {
+  static uint8_t info[4096];
+  memset(info, 0xab, sizeof(info));
+
+  SctpChunk chunks[2];
+  for (int32_t i = 0; i < count; i++) {
+    chunks[i].type = Sctp_Heartbeat;
+    chunks[i].flags = 0;
+    chunks[i].length = uint16_t(infoLength + 8);
+    chunks[i].as.heartbeat.heartbeatInfoLen = infoLength;
+    chunks[i].as.heartbeat.heartbeatInfo = info;
+  }
+
+  SctpPacket packet;
+  packet.sourcePort = kLoopbackSctpPort;
+  packet.destionationPort = kLoopbackSctpPort;
+  packet.verificationTag = peer->verificationTag;
+
+  static uint8_t buf[3 * 4096];
+  const size_t length =
+      SerializeSctpPacket(&packet, chunks, count, buf, sizeof(buf));
+  Expect(length > 0, "heartbeats serialized");
+
+  // The record is larger than the MTU and the buffer LoopbackFlush uses.
+  SSL_set_mtu(peer->ssl, sizeof(buf));
+  SSL_write(peer->ssl, buf, int(length));
+  const int bytes = BIO_read(peer->outBio, buf, sizeof(buf));
+  LoopbackSendRaw(lb, peer, buf, bytes);
+  SSL_set_mtu(peer->ssl, 1200);
+  LoopbackPump(lb);
+}
+
+int main() {
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+
+  Loopback lb;
+  if (!LoopbackStart(&lb, &wu, &conf, 1)) {
+    return 1;
+  }
+
+  LoopbackPeer* peer = &lb.peers[0];
+
+  SendHeartbeats(&lb, peer, 2, kLargeInfo);
+  Expect(peer->heartbeatAcks == 2 &&
+             peer->heartbeatAckBytes == 2 * kLargeInfo,
+         "acks split over two packets");
+
+  SendHeartbeats(&lb, peer, 1, 4090);
+  Expect(peer->heartbeatAcks == 2, "ack larger than a packet not sent");
+
+  SctpChunk chunk;
+  chunk.type = Sctp_Heartbeat;
+  chunk.flags = 0;
+  chunk.length = 8;
+  chunk.as.heartbeat.heartbeatInfoLen = 0;
+  chunk.as.heartbeat.heartbeatInfo = NULL;
+  uint8_t small[64];
+  SctpPacket packet = {kLoopbackSctpPort, kLoopbackSctpPort, 0, 0};
+  Expect(SerializeSctpPacket(&packet, &chunk, 1, small, 19) == 0,
+         "serializing past the buffer refused");
+  Expect(SerializeSctpPacket(&packet, &chunk, 1, small, 20) == 20,
+         "serializing into an exact fit");
+
+  LoopbackDestroy(&lb);
+
+  return TestResult();
+}
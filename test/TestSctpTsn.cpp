@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include "../Wu.h"
+#include "../WuSctp.h"
+#include "Loopback.h"
+#include "Test.h"
+
+// Receive side TSN tracking: duplicates are detected across reordering,
+// window slides and wrap-around, duplicated DATA chunks aren't delivered
+// twice, SACKs carry the cumulative TSN and gap blocks, and FORWARD-TSN is
+// honoured in both directions.
+
+static void TestTracker() {
+  SctpTsnTracker tracker;
+  SctpTsnTrackerInit(&tracker, 100);
+
+  Expect(SctpTsnTrackerAdd(&tracker, 100), "first TSN is new");
+  Expect(!SctpTsnTrackerAdd(&tracker, 100), "repeated TSN is a duplicate");
+  Expect(!SctpTsnTrackerAdd(&tracker, 99), "TSN before the initial one");
+  Expect(tracker.cumulativeTsn == 100, "cumulative TSN advances");
+
+  Expect(SctpTsnTrackerAdd(&tracker, 103), "TSN after a gap is new");
+  Expect(tracker.cumulativeTsn == 100, "gap holds the cumulative TSN");
+  Expect(!SctpTsnTrackerAdd(&tracker, 103), "duplicate past a gap");
+  Expect(SctpTsnTrackerAdd(&tracker, 102), "reordered TSN is new");
+  Expect(SctpTsnTrackerAdd(&tracker, 101), "gap filled");
+  Expect(tracker.cumulativeTsn == 103, "filled gap advances cumulative TSN");
+
+  // 104 is lost, a TSN far ahead slides it out of the window.
+  Expect(SctpTsnTrackerAdd(&tracker, 105), "TSN after a loss");
+  Expect(SctpTsnTrackerAdd(&tracker, 105 + kSctpTsnWindow), "window slides");
+  Expect(!SctpTsnTrackerAdd(&tracker, 104), "TSN left behind the window");
+  Expect(!SctpTsnTrackerAdd(&tracker, 105 + kSctpTsnWindow),
+         "duplicate after a slide");
+  Expect(SctpTsnTrackerAdd(&tracker, 106), "TSN still inside the window");
+
+  SctpTsnTrackerInit(&tracker, 0xFFFFFFFE);
+  Expect(SctpTsnTrackerAdd(&tracker, 0xFFFFFFFE), "TSN before wrap");
+  Expect(SctpTsnTrackerAdd(&tracker, 0), "TSN after wrap");
+  Expect(SctpTsnTrackerAdd(&tracker, 0xFFFFFFFF), "reordered across wrap");
+  Expect(tracker.cumulativeTsn == 0, "cumulative TSN wraps");
+  Expect(!SctpTsnTrackerAdd(&tracker, 0xFFFFFFFF), "duplicate across wrap");
+
+  SctpTsnTrackerInit(&tracker, 1);
+  SctpTsnTrackerAdd(&tracker, 1);
+  SctpTsnTrackerAdd(&tracker, 3);
+  SctpTsnTrackerAdd(&tracker, 4);
+  SctpTsnTrackerAdd(&tracker, 7);
+  uint16_t blocks[2 * kSctpMaxGapBlocks];
+  Expect(SctpTsnTrackerGapBlocks(&tracker, blocks, kSctpMaxGapBlocks) == 2,
+         "two gap blocks");
+  Expect(blocks[0] == 2 && blocks[1] == 3 && blocks[2] == 6 && blocks[3] == 6,
+         "gap block offsets");
+  Expect(SctpTsnTrackerGapBlocks(&tracker, blocks, 1) == 1,
+         "gap blocks are capped");
+
+  SctpTsnTrackerForward(&tracker, 5);
+  Expect(tracker.cumulativeTsn == 5, "FORWARD-TSN skips the gaps");
+  Expect(SctpTsnTrackerGapBlocks(&tracker, blocks, kSctpMaxGapBlocks) == 1,
+         "gap blocks past the forwarded TSN remain");
+  SctpTsnTrackerForward(&tracker, 6);
+  Expect(tracker.cumulativeTsn == 7, "FORWARD-TSN joins received TSNs");
+  SctpTsnTrackerForward(&tracker, 2);
+  Expect(tracker.cumulativeTsn == 7, "stale FORWARD-TSN is ignored");
+}
+
+static void TestDuplicateDelivery() {
+  Wu wu;
+  WuConf conf;
+
+  Loopback lb;
+  if (!LoopbackStart(&lb, &wu, &conf, 1)) {
+    failures++;
+    return;
+  }
+
+  LoopbackPeer* peer = &lb.peers[0];
+  const uint8_t message[4] = {1, 2, 3, 4};
+  LoopbackSendBinary(&lb, peer, message, sizeof(message));
+  peer->tsn--;
+  LoopbackSendBinary(&lb, peer, message, sizeof(message));
+  LoopbackPump(&lb);
+  Expect(peer->sackDupTsns == 1, "duplicate reported in the SACK");
+  LoopbackSendBinary(&lb, peer, message, sizeof(message));
+
+  int32_t delivered = 0;
+  WuEvent evt;
+  while (WuUpdate(&wu, &evt)) {
+    delivered += evt.type == WuEvent_BinaryData ? 1 : 0;
+  }
+
+  Expect(delivered == 2, "duplicated message delivered once");
+  Expect(wu.stats.duplicateTsns == 1, "duplicate counted");
+
+  LoopbackDestroy(&lb);
+}
+
+static void TestSackAndForwardTsn() {
+  Wu wu;
+  WuConf conf;
+
+  Loopback lb;
+  if (!LoopbackStart(&lb, &wu, &conf, 1)) {
+    failures++;
+    return;
+  }
+
+  LoopbackPeer* peer = &lb.peers[0];
+  const uint32_t t = peer->tsn;
+  const uint8_t message[4] = {1, 2, 3, 4};
+
+  // Reordered: t + 1 arrives before t.
+  peer->tsn = t + 1;
+  LoopbackSendBinary(&lb, peer, message, sizeof(message));
+  LoopbackPump(&lb);
+  Expect(peer->sackTsn == t - 1 && peer->sackGapBlocks == 1,
+         "SACK doesn't ack past a missing TSN");
+
+  peer->tsn = t;
+  LoopbackSendBinary(&lb, peer, message, sizeof(message));
+  LoopbackPump(&lb);
+  Expect(peer->sackTsn == t + 1 && peer->sackGapBlocks == 0,
+         "SACK acks the filled gap");
+
+  // Lost: t + 2 never arrives and the peer abandons it.
+  peer->tsn = t + 3;
+  LoopbackSendBinary(&lb, peer, message, sizeof(message));
+  LoopbackPump(&lb);
+  Expect(peer->sackTsn == t + 1 && peer->sackGapBlocks == 1, "gap for a loss");
+
+  SctpChunk forward;
+  forward.type = SctpChunk_ForwardTsn;
+  forward.flags = 0;
+  forward.length = SctpChunkLength(4);
+  forward.as.forwardTsn.newCumulativeTsn = t + 2;
+  LoopbackSendSctp(&lb, peer, &forward, 1);
+  LoopbackPump(&lb);
+  Expect(peer->sackTsn == t + 3 && peer->sackGapBlocks == 0,
+         "FORWARD-TSN honoured");
+  Expect(wu.stats.forwardTsnsIn == 1, "FORWARD-TSN counted");
+
+  // The peer reports a gap in our unreliable DATA, we forward past the last
+  // TSN actually sent.
+  WuEvent evt;
+  while (WuUpdate(&wu, &evt)) {
+  }
+  WuSendBinary(&wu, peer->client, message, sizeof(message));
+  LoopbackPump(&lb);
+
+  const uint16_t gap[2] = {2, 2};
+  SctpChunk sack;
+  sack.type = Sctp_Sack;
+  sack.flags = 0;
+  sack.length = SctpChunkLength(12 + 4);
+  sack.as.sack.cumulativeTsnAck = peer->lastDataTsn - 2;
+  sack.as.sack.advRecvWindow = kSctpDefaultBufferSpace;
+  sack.as.sack.numGapAckBlocks = 1;
+  sack.as.sack.numDupTsn = 0;
+  sack.as.sack.gapAckBlocks = gap;
+  sack.as.sack.dupTsns = NULL;
+  LoopbackSendSctp(&lb, peer, &sack, 1);
+  LoopbackPump(&lb);
+  Expect(peer->forwardTsn == peer->lastDataTsn,
+         "FORWARD-TSN names the last TSN sent");
+
+  printf("%llu control packets sent for %llu DATA chunks received\n",
+         (unsigned long long)wu.stats.controlPacketsOut,
+         (unsigned long long)wu.stats.dataChunksIn);
+
+  LoopbackDestroy(&lb);
+}
+
+int main() {
+  TestTracker();
+  TestDuplicateDelivery();
+  TestSackAndForwardTsn();
+
+  return TestResult();
+}
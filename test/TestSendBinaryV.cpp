@@ -0,0 +1,61 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/uio.h>
+#include "../Wu.h"
+#include "Loopback.h"
+#include "Test.h"
+
+// WuSendBinaryV delivers the concatenation of its buffers, including empty
+// ones and lengths that need SCTP padding, and refuses messages that don't
+// fit an SCTP packet.
+
+int main() {
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+
+  Loopback lb;
+  if (!LoopbackStart(&lb, &wu, &conf, 1)) {
+    return 1;
+  }
+
+  LoopbackPeer* peer = &lb.peers[0];
+
+  const uint8_t header[3] = {'h', 'd', 'r'};
+  const uint8_t position[5] = {1, 2, 3, 4, 5};
+  const uint8_t velocity[2] = {6, 7};
+  iovec buffers[4];
+  buffers[0].iov_base = (void*)header;
+  buffers[0].iov_len = sizeof(header);
+  buffers[1].iov_base = (void*)position;
+  buffers[1].iov_len = sizeof(position);
+  buffers[2].iov_base = NULL;
+  buffers[2].iov_len = 0;
+  buffers[3].iov_base = (void*)velocity;
+  buffers[3].iov_len = sizeof(velocity);
+
+  Expect(WuSendBinaryV(&wu, peer->client, buffers, 4) == 0, "gathered send");
+  LoopbackPump(&lb);
+
+  const uint8_t expected[10] = {'h', 'd', 'r', 1, 2, 3, 4, 5, 6, 7};
+  Expect(peer->received == 1, "one message received");
+  Expect(peer->lastMessageLength == int32_t(sizeof(expected)) &&
+             memcmp(peer->lastMessage, expected, sizeof(expected)) == 0,
+         "buffers concatenated in order");
+
+  static uint8_t large[8192];
+  buffers[0].iov_base = large;
+  buffers[0].iov_len = sizeof(large);
+  Expect(WuSendBinaryV(&wu, peer->client, buffers, 1) < 0,
+         "message larger than an SCTP packet refused");
+
+  // Would sum to 15 if the lengths were added as int32_t.
+  buffers[0].iov_len = SIZE_MAX;
+  buffers[1].iov_len = 16;
+  Expect(WuSendBinaryV(&wu, peer->client, buffers, 2) < 0,
+         "lengths that wrap around refused");
+
+  LoopbackDestroy(&lb);
+
+  return TestResult();
+}
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "../Wu.h"
+#include "../WuClock.h"
+#include "../WuShm.h"
+#include "Loopback.h"
+#include "Test.h"
+
+// A forked application process echoes messages through the shared memory
+// rings. When it exits without detaching the daemon takes the region back,
+// and the next application to attach is told about the connected clients.
+// Slots released twice or never handed out are ignored.
+
+const int32_t kNumSlots = 16;
+
+// What WuDaemon does with the epoll host.
+static void DaemonStep(Loopback* lb, WuShm* shm) {
+  LoopbackPump(lb);
+  WuShmUpdate(shm);
+
+  WuEvent evt;
+  while (WuUpdate(lb->wu, &evt)) {
+    WuShmPushEvent(shm, &evt);
+    if (evt.type == WuEvent_ClientLeave) {
+      WuRemoveClient(lb->wu, evt.client);
+    }
+  }
+
+  WuShmCommand cmd;
+  while (WuShmPollCommand(shm, &cmd)) {
+    if (cmd.type == WuShmCommand_SendBinary) {
+      WuSendBinary(lb->wu, cmd.client, cmd.data, cmd.length);
+    } else if (cmd.type == WuShmCommand_RemoveClient) {
+      WuRemoveClient(lb->wu, cmd.client);
+    }
+    WuShmReleaseCommand(shm, &cmd);
+  }
+}
+
+// Echoes two messages and exits without detaching.
+static int RunApp(const char* name, int ready) {
+  WuShm* shm = WuShmAttach(name);
+  if (!shm) {
+    return 2;
+  }
+
+  const char attached = 1;
+  if (write(ready, &attached, 1) != 1) {
+    return 3;
+  }
+
+  int32_t joins = 0;
+  int32_t echoed = 0;
+  const double start = MsNow() * 0.001;
+  while (echoed < 2 && MsNow() * 0.001 - start < 5.0) {
+    WuShmEvent evt;
+    if (!WuShmPoll(shm, &evt)) {
+      usleep(100);
+      continue;
+    }
+
+    if (evt.type == WuEvent_ClientJoin) {
+      joins++;
+    } else if (evt.type == WuEvent_BinaryData) {
+      int32_t slot;
+      uint8_t* buffer = WuShmAcquireBuffer(shm, &slot);
+      for (int32_t i = 0; buffer && i < evt.length; i++) {
+        buffer[i] = evt.data[evt.length - 1 - i];
+      }
+      if (buffer && WuShmSendBinary(shm, evt.clientId, slot, evt.length)) {
+        echoed++;
+      }
+    }
+
+    WuShmReleaseEvent(shm, &evt);
+  }
+
+  return joins == 2 && echoed == 2 ? 0 : 1;
+}
+
+static bool RunUntil(Loopback* lb, WuShm* shm, bool (*done)(Loopback*, WuShm*),
+                     double timeout) {
+  const double start = MsNow() * 0.001;
+  while (!done(lb, shm)) {
+    if (MsNow() * 0.001 - start > timeout) {
+      return false;
+    }
+    DaemonStep(lb, shm);
+    usleep(1000);
+  }
+  return true;
+}
+
+static bool AllOpen(Loopback* lb, WuShm*) {
+  return lb->peers[0].open && lb->peers[1].open;
+}
+
+static bool Echoed(Loopback* lb, WuShm*) {
+  return lb->peers[0].lastMessageLength == 3 &&
+         lb->peers[1].lastMessageLength == 3;
+}
+
+static bool WasReset(Loopback*, WuShm* shm) {
+  WuShmStats stats;
+  WuShmGetStats(shm, &stats);
+  return stats.resets == 1;
+}
+
+int main() {
+  char name[64];
+  snprintf(name, sizeof(name), "/webudp-test-%d", int(getpid()));
+
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+  conf.handshakeBudget = 0.0;
+  // Sized like WuInit does, with the default limit.
+  conf.maxClients = 0;
+
+  if (!WuInit(&wu, &conf)) {
+    printf("WuInit failed\n");
+    return 1;
+  }
+
+  WuShm* shm = WuShmCreate(&conf, name, kNumSlots);
+  if (!shm) {
+    printf("WuShmCreate failed\n");
+    return 1;
+  }
+
+  int ready[2];
+  if (pipe(ready) == -1) {
+    printf("pipe failed\n");
+    return 1;
+  }
+
+  pid_t app = fork();
+  if (app == 0) {
+    close(ready[0]);
+    _exit(RunApp(name, ready[1]));
+  }
+
+  close(ready[1]);
+  char attached = 0;
+  Expect(read(ready[0], &attached, 1) == 1, "application attached");
+  close(ready[0]);
+
+  Loopback lb;
+  LoopbackInit(&lb, &wu, 2);
+  LoopbackConnect(&lb, 0);
+  LoopbackConnect(&lb, 1);
+  if (!RunUntil(&lb, shm, AllOpen, 5.0)) {
+    printf("data channels didn't open\n");
+    return 1;
+  }
+
+  LoopbackPeer* peers = lb.peers;
+  const uint8_t message[3] = {1, 2, 3};
+  LoopbackSendBinary(&lb, &peers[0], message, sizeof(message));
+  LoopbackSendBinary(&lb, &peers[1], message, sizeof(message));
+  Expect(RunUntil(&lb, shm, Echoed, 5.0), "echoed by the application");
+  Expect(peers[0].lastMessage[0] == 3 && peers[1].lastMessage[2] == 1,
+         "payload written by the application");
+
+  int status = -1;
+  waitpid(app, &status, 0);
+  Expect(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+         "application saw both joins");
+
+  // Two event slots were never released, the reset takes them back.
+  Expect(RunUntil(&lb, shm, WasReset, 3.0), "exited application detected");
+
+  WuShm* next = WuShmAttach(name);
+  Expect(next != NULL, "attach after the previous application exited");
+  Expect(WuShmAttach(name) == NULL, "one application at a time");
+  DaemonStep(&lb, shm);
+
+  const uint32_t ids[2] = {WuClientGetId(peers[0].client),
+                           WuClientGetId(peers[1].client)};
+  int32_t joins = 0;
+  WuShmEvent evt;
+  while (next && WuShmPoll(next, &evt)) {
+    joins += evt.type == WuEvent_ClientJoin &&
+             (evt.clientId == ids[0] || evt.clientId == ids[1]);
+  }
+  Expect(joins == 2, "connected clients announced");
+
+  // Every send slot is available again.
+  int32_t acquired = 0;
+  int32_t slot = -1;
+  while (next && WuShmAcquireBuffer(next, &slot)) {
+    acquired++;
+  }
+  Expect(acquired == kNumSlots, "send slots reclaimed");
+
+  if (next) {
+    WuShmRemoveClient(next, ids[0]);
+    WuShmSendBinary(next, ids[0], slot, 1);
+  }
+  DaemonStep(&lb, shm);
+  Expect(wu.numClients == 1, "client removed");
+
+  WuShmStats stats;
+  WuShmGetStats(shm, &stats);
+  Expect(stats.droppedCommands == 1, "send to a removed client dropped");
+  Expect(next && WuShmAcquireBuffer(next, &slot) != NULL,
+         "dropped send returned its slot");
+
+  // A buffer released twice goes back once, a handle that was never
+  // acquired isn't taken.
+  if (next) {
+    WuShmReleaseBuffer(next, slot);
+    WuShmReleaseBuffer(next, slot);
+    WuShmReleaseBuffer(next, 0);
+  }
+  DaemonStep(&lb, shm);
+  WuShmGetStats(shm, &stats);
+  Expect(stats.badEntries == 2, "bad releases counted");
+  Expect(next && WuShmAcquireBuffer(next, &slot) != NULL &&
+             WuShmAcquireBuffer(next, &slot) == NULL,
+         "released buffer available once");
+
+  if (next) {
+    WuShmDetach(next);
+  }
+  DaemonStep(&lb, shm);
+  WuShmGetStats(shm, &stats);
+  Expect(stats.resets == 2, "detach resets the region");
+
+  WuShmDestroy(shm);
+  Expect(WuShmAttach(name) == NULL, "region removed");
+  LoopbackDestroy(&lb);
+
+  return TestResult();
+}
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <unistd.h>
+#include "../Wu.h"
+#include "AllocCounter.h"
+#include "Loopback.h"
+
+// Fails when Wu allocates while sending or receiving data channel messages
+// once connections are warmed up, with the default hibernation timeout. Only
+// calls into Wu are counted, the loopback peers run with counting paused.
+
+const int32_t kNumPeers = 8;
+const int32_t kWarmupRounds = 16;
+const int32_t kRounds = 256;
+
+static void WritePaused(const uint8_t* data, size_t length,
+                        const WuClient* client, void* userData) {
+  AllocScope paused(false);
+  LoopbackWrite(data, length, client, userData);
+}
+
+static void HandleUDP(Loopback* lb, LoopbackPeer* peer, const uint8_t* data,
+                      int32_t length) {
+  AllocScope counted(true);
+  WuHandleUDP(lb->wu, &peer->address, data, length);
+}
+
+static void Update(Wu* wu) {
+  AllocScope counted(true);
+  WuEvent evt;
+  while (WuUpdate(wu, &evt)) {
+  }
+}
+
+static void SendBinary(Wu* wu, WuClient* client, const uint8_t* data,
+                       int32_t length) {
+  AllocScope counted(true);
+  WuSendBinary(wu, client, data, length);
+}
+
+// Each peer sends one message, the server echoes it back.
+static void RunRound(Loopback* lb, const uint8_t* data, int32_t length) {
+  for (int32_t i = 0; i < lb->numPeers; i++) {
+    LoopbackPeer* peer = &lb->peers[i];
+    LoopbackSendBinary(lb, peer, data, length);
+    SendBinary(lb->wu, peer->client, data, length);
+  }
+
+  Update(lb->wu);
+  LoopbackPump(lb);
+}
+
+// Only the server sends, the peers answer with SACKs.
+static void RunSendRound(Loopback* lb, const uint8_t* data, int32_t length) {
+  for (int32_t i = 0; i < lb->numPeers; i++) {
+    SendBinary(lb->wu, lb->peers[i].client, data, length);
+  }
+
+  Update(lb->wu);
+  LoopbackPump(lb);
+}
+
+static bool CountAllocs(const char* what, int32_t messages) {
+  printf("%s, %d messages: %llu allocations, %llu frees\n", what, messages,
+         (unsigned long long)allocCounter.allocs,
+         (unsigned long long)allocCounter.frees);
+  const bool passed = allocCounter.allocs == 0;
+  allocCounter.allocs = 0;
+  allocCounter.frees = 0;
+  return passed;
+}
+
+int main() {
+  Wu wu;
+  WuConf conf;
+
+  Loopback lb;
+  if (!LoopbackStart(&lb, &wu, &conf, kNumPeers)) {
+    return 1;
+  }
+
+  WuSetUDPWriteFunction(&wu, WritePaused);
+  lb.send = HandleUDP;
+
+  uint8_t message[256];
+  memset(message, 0xab, sizeof(message));
+
+  for (int32_t i = 0; i < kWarmupRounds; i++) {
+    RunRound(&lb, message, sizeof(message));
+  }
+
+  allocCounter.allocs = 0;
+  allocCounter.frees = 0;
+
+  for (int32_t i = 0; i < kRounds; i++) {
+    RunRound(&lb, message, sizeof(message));
+  }
+
+  bool passed = CountAllocs("echo", 2 * kNumPeers * kRounds);
+
+  // Clients that go idle hibernate, then only receive. The first message
+  // wakes each of them up.
+  usleep(useconds_t((wu.hibernateTimeout + 0.1) * 1e6));
+  WuEvent evt;
+  while (WuUpdate(&wu, &evt)) {
+  }
+
+  if (wu.numHibernatedClients != kNumPeers) {
+    printf("only %d clients hibernated\n", wu.numHibernatedClients);
+    return 1;
+  }
+
+  for (int32_t i = 0; i < kWarmupRounds; i++) {
+    RunSendRound(&lb, message, sizeof(message));
+  }
+
+  allocCounter.allocs = 0;
+  allocCounter.frees = 0;
+
+  for (int32_t i = 0; i < kRounds; i++) {
+    RunSendRound(&lb, message, sizeof(message));
+  }
+
+  passed = CountAllocs("receive only", kNumPeers * kRounds) && passed;
+
+  return passed ? 0 : 1;
+}
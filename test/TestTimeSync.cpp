@@ -0,0 +1,118 @@
+#include <math.h>
+#include <stdio.h>
+#include "../Wu.h"
+#include "../WuClock.h"
+#include "../WuTimeSync.h"
+#include "Loopback.h"
+#include "Test.h"
+
+// Time sync packets are answered inline with the server's monotonic time,
+// and the client's answers give the server an estimate of its offset and
+// round trip. Other binary messages are still delivered.
+
+const double kClientAhead = 50.0;
+
+static double ClientNow() { return MsNow() * 0.001 + kClientAhead; }
+
+static void SendTimeSync(Loopback* lb, LoopbackPeer* peer,
+                         const TimeSyncPacket* packet) {
+  uint8_t buf[kTimeSyncPacketLength];
+  SerializeTimeSyncPacket(packet, buf, sizeof(buf));
+  LoopbackSendBinary(lb, peer, buf, sizeof(buf));
+}
+
+static int32_t Update(Wu* wu) {
+  int32_t delivered = 0;
+  WuEvent evt;
+  while (WuUpdate(wu, &evt)) {
+    delivered += evt.type == WuEvent_BinaryData ? 1 : 0;
+  }
+  return delivered;
+}
+
+static void TestPacket() {
+  TimeSyncPacket packet = {1.5, -2.25, 1e9};
+  uint8_t buf[kTimeSyncPacketLength];
+  Expect(SerializeTimeSyncPacket(&packet, buf, sizeof(buf)) ==
+             kTimeSyncPacketLength,
+         "serialized");
+  Expect(buf[0] == 'W' && buf[8] == 0x3F && buf[9] == 0xF8,
+         "magic and big endian timestamps");
+
+  TimeSyncPacket parsed;
+  Expect(ParseTimeSyncPacket(buf, sizeof(buf), &parsed) &&
+             parsed.origin == 1.5 && parsed.receive == -2.25 &&
+             parsed.transmit == 1e9,
+         "round trip");
+  Expect(!ParseTimeSyncPacket(buf, sizeof(buf) - 1, &parsed),
+         "wrong length rejected");
+  buf[1] = 'x';
+  Expect(!ParseTimeSyncPacket(buf, sizeof(buf), &parsed),
+         "wrong magic rejected");
+}
+
+static void TestExchange() {
+  Wu wu;
+  WuConf conf;
+  conf.hibernateTimeout = 0.0;
+  conf.timeSync = true;
+
+  Loopback lb;
+  if (!LoopbackStart(&lb, &wu, &conf, 1)) {
+    failures++;
+    return;
+  }
+
+  LoopbackPeer* peer = &lb.peers[0];
+  WuTimeSync sync;
+
+  const double t1 = ClientNow();
+  TimeSyncPacket request = {0.0, 0.0, t1};
+  SendTimeSync(&lb, peer, &request);
+  Expect(Update(&wu) == 0, "request not delivered");
+  LoopbackPump(&lb);
+  const double t4 = ClientNow();
+
+  TimeSyncPacket reply;
+  Expect(ParseTimeSyncPacket(peer->lastMessage, peer->lastMessageLength,
+                             &reply),
+         "answered");
+  Expect(reply.origin == t1, "request transmit time echoed");
+  Expect(reply.receive <= reply.transmit &&
+             fabs(reply.transmit - MsNow() * 0.001) < 0.1,
+         "server monotonic timestamps");
+  const double clientOffset =
+      ((reply.receive - t1) + (reply.transmit - t4)) * 0.5;
+  Expect(fabs(clientOffset + kClientAhead) < 0.01, "client side offset");
+  Expect(!WuClientGetTimeSync(peer->client, &sync), "no sample yet");
+
+  // The next request completes the server's exchange.
+  TimeSyncPacket answer = {reply.transmit, t4, ClientNow()};
+  SendTimeSync(&lb, peer, &answer);
+  Update(&wu);
+  Expect(WuClientGetTimeSync(peer->client, &sync) && sync.samples == 1,
+         "server sample");
+  Expect(fabs(sync.offset - kClientAhead) < 0.01, "server side offset");
+  Expect(sync.rtt >= 0.0 && sync.rtt < 0.1, "server side rtt");
+
+  // A packet that doesn't echo the last transmit time isn't a sample.
+  TimeSyncPacket stale = {reply.transmit, t4, ClientNow()};
+  SendTimeSync(&lb, peer, &stale);
+  Update(&wu);
+  WuClientGetTimeSync(peer->client, &sync);
+  Expect(sync.samples == 1, "stale origin ignored");
+  Expect(wu.stats.timeSyncPackets == 3, "packets counted");
+
+  uint8_t other[kTimeSyncPacketLength] = {'X', 'u', 'T', 'S', 1};
+  LoopbackSendBinary(&lb, peer, other, sizeof(other));
+  Expect(Update(&wu) == 1, "other binary messages delivered");
+
+  LoopbackDestroy(&lb);
+}
+
+int main() {
+  TestPacket();
+  TestExchange();
+
+  return TestResult();
+}